@@ -0,0 +1,130 @@
+/* Check that steady-state HMC sampling doesn't allocate memory
+ *
+ * Replaces the global operator new, and the malloc and posix_memalign
+ * Armadillo allocates matrices with (glibc only), with versions counting
+ * allocations. After a warm-up that includes adaptation of the step-size
+ * and a diagonal metric, the Markov kernel is applied n_iter times to a
+ * 100-dimensional Gaussian, with samples not stored, and no allocation
+ * may be made. The same goes for repeated calls of the (x, v) form of
+ * leapfrog_transform. Returns 0 on success, 1 otherwise.
+ */
+#include "hmc.h"
+#include "leapfrog.h"
+#include "log_post.h"
+#include "metric.h"
+#include <armadillo>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+extern "C" void* __libc_malloc(std::size_t size);
+extern "C" void* __libc_memalign(std::size_t alignment,
+                                 std::size_t size);
+
+// Number of allocations made so far
+static long long n_allocs = 0;
+
+void* operator new(std::size_t size)
+{
+    ++n_allocs;
+    void *p = __libc_malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+extern "C" void* malloc(std::size_t size) noexcept
+{
+    ++n_allocs;
+    return __libc_malloc(size);
+}
+
+extern "C" int posix_memalign(void **p,
+                              std::size_t alignment,
+                              std::size_t size) noexcept
+{
+    ++n_allocs;
+    *p = __libc_memalign(alignment, size);
+    return *p ? 0 : ENOMEM;
+}
+
+/* Log-density of independent Gaussians with mean zero
+ *
+ * Written as loops, so that evaluating it doesn't allocate memory
+ *
+ * state : State at which to evaluate the log-density
+ * data  : Precision of each component (a column)
+ */
+double ind_gauss_ld(const arma::vec &state,
+                    const arma::mat &data)
+{
+    double ld = 0.0;
+    for (arma::uword i = 0; i < state.n_elem; ++i)
+    {
+        ld -= 0.5 * data(i, 0) * state[i] * state[i];
+    }
+    return ld;
+}
+
+/* Gradient of the log-density of independent Gaussians with mean zero
+ *
+ * state : State at which to evaluate the gradient
+ * grad  : The gradient
+ * data  : Precision of each component (a column)
+ */
+void ind_gauss_grad_ld(const arma::vec &state,
+                       arma::vec &grad,
+                       const arma::mat &data)
+{
+    for (arma::uword i = 0; i < state.n_elem; ++i)
+    {
+        grad[i] = -data(i, 0) * state[i];
+    }
+}
+
+int main()
+{
+    int d = 100; // Dimension (large enough for Armadillo to use the heap)
+    arma::mat precision(d, 1);
+    for (int i = 0; i < d; ++i) precision(i, 0) = 1.0 + i;
+    LogPost post(d, precision, ind_gauss_ld, ind_gauss_grad_ld);
+    arma::vec init(d, arma::fill::ones);
+    
+    int burn = 1000;
+    int n_iter = 1000;
+    double epsilon = 0.05;
+    int L = 20;
+    HMC mc(post, init, burn, 1, 2 * n_iter, epsilon, L);
+    mc.set_seed(1);
+    mc.adapt_step_size();
+    mc.adapt_metric(Metric::DIAG);
+    mc.set_store_samples(0);
+    
+    // Warm-up: the burn-in period, at the end of which the adapted
+    // step-size and metric are fixed
+    mc.step(burn);
+    
+    // The run is longer than the warm-up and n_iter, so doesn't finish
+    long long n_before = n_allocs;
+    mc.step(n_iter);
+    long long n = n_allocs - n_before;
+    
+    std::cout << n << " allocations in " << n_iter
+              << " applications of the HMC kernel\n";
+    
+    // The first call sizes the integrator's gradient buffer
+    arma::vec x(init);
+    arma::vec v(d, arma::fill::ones);
+    leapfrog_transform(x, v, post, epsilon, L);
+    
+    n_before = n_allocs;
+    for (int i = 0; i < n_iter; ++i)
+    {
+        leapfrog_transform(x, v, post, epsilon, L);
+    }
+    long long n_leapfrog = n_allocs - n_before;
+    
+    std::cout << n_leapfrog << " allocations in " << n_iter
+              << " calls of leapfrog_transform\n";
+    return ((n == 0) && (n_leapfrog == 0)) ? 0 : 1;
+}
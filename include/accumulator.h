@@ -0,0 +1,92 @@
+/* Class accumulating estimates of moments from a stream of samples
+ *
+ * Uses Welford's updates, so that estimates remain accurate over very
+ * long chains, and the samples themselves needn't be stored.
+ */
+#ifndef ACCUMULATOR_H
+#define ACCUMULATOR_H
+
+#include <armadillo>
+#include <iostream>
+#include <vector>
+
+class Accumulator
+{
+public:
+    /* Constructor
+     *
+     * dimension : Dimension of the samples
+     * track_cov : Indicator of whether to estimate the full covariance
+     *             matrix (costs O(dimension^2) per sample)
+     */
+    Accumulator(const int dimension = 1,
+                const int track_cov = 0);
+    
+    /* Add a scalar function whose expectation to estimate
+     *
+     * Must be called before any samples are added.
+     * Returns the index of the function, used to get its estimate.
+     *
+     * fcn : Function of the state
+     */
+    int add_fcn(double (*fcn)(const arma::vec &state));
+    
+    // Add a sample
+    void add(const arma::vec &x);
+    
+    // Discard all samples added so far (functions are kept)
+    void reset();
+    
+    // Get dimension
+    int get_dimension();
+    
+    // Get number of samples added
+    long long get_n();
+    
+    // Get estimate of the mean
+    void get_mean(arma::vec &mean);
+    
+    // Get estimate of the (marginal) variances
+    void get_var(arma::vec &var);
+    
+    // Get estimate of the covariance matrix (requires track_cov)
+    void get_cov(arma::mat &cov);
+    
+    /* Get estimates of moments
+     *
+     * mo1_est : estimate of the first moment
+     * mo2_est : estimate of the second moment
+     */
+    void get_moments(arma::vec &mo1_est,
+                     arma::vec &mo2_est);
+    
+    // Get estimate of the expectation of function i
+    double get_fcn_mean(const int i);
+    
+    // Write the estimates to a binary stream (functions added with add_fcn
+    // aren't written, so must be added again before calling load)
+    void save(std::ostream &out);
+    
+    // Restore estimates written by save
+    void load(std::istream &in);
+    
+private:
+    // Dimension, indicator of whether to estimate the covariance
+    int m_dimension, m_track_cov;
+    
+    // Number of samples
+    long long m_n;
+    
+    // Running mean, sum of squared deviations from the mean,
+    // deviation of the latest sample from the previous mean
+    arma::vec m_mean, m_m2, m_delta;
+    
+    // Sum of products of deviations from the mean
+    arma::mat m_comoment;
+    
+    // Functions and the running means of their values
+    std::vector<double (*)(const arma::vec &state)> m_fcns;
+    std::vector<double> m_fcn_means;
+};
+
+#endif
@@ -0,0 +1,131 @@
+/* Class representing an ensemble of Markov chains run in parallel
+ */
+#ifndef CHAIN_ENSEMBLE_H
+#define CHAIN_ENSEMBLE_H
+
+#include "mcmc.h"
+#include <armadillo>
+#include <memory>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+class ChainEnsemble
+{
+public:
+    /* Constructor
+     *
+     * Each chain is a copy of prototype, with its random number generator
+     * seeded using seed and the index of the chain as the stream, so that
+     * the samples generated depend on seed only (and not on n_threads).
+     * Copies don't share the prototype's writer or accumulator, which
+     * aren't safe to use from several threads; give chains their own using
+     * get_chain(i). If the prototype writes checkpoints to a file, chain i
+     * writes them to that file name followed by "." and i, from which it
+     * can be restored with get_chain(i).load_checkpoint before run().
+     * For a log density set by LogPost::set_sum_log_lik, each copy gets
+     * its own pool of threads, with as many threads as the prototype's, so
+     * that chains don't take turns evaluating it; give set_sum_log_lik a
+     * small number of threads to avoid using more threads than cores.
+     *
+     * prototype : Markov chain (of any subclass of MCMC) to copy
+     * n_chains  : Number of chains
+     * seed      : Master seed
+     * n_threads : Number of threads. If not positive, uses the number
+     *             of hardware threads.
+     */
+    template <class Chain>
+    ChainEnsemble(const Chain &prototype,
+                  const int n_chains,
+                  const unsigned long long seed,
+                  const int n_threads = 0);
+    
+    // Get number of chains
+    int get_n_chains();
+    
+    // Get number of threads
+    int get_n_threads();
+    
+    // Get chain i, e.g. to set its initial state before calling run()
+    MCMC& get_chain(const int i);
+    
+    /* Generate every chain, distributing the chains over the threads
+     *
+     * Chains that store their samples record them directly in the slices
+     * of get_samples(), so the chains' own get_samples() are empty.
+     */
+    void run();
+    
+    /* Generate every chain until the chains have converged
+     *
+     * Chains are advanced in parallel, check_interval samples at a time
+     * (after burn-in), until the batch means effective sample size summed
+     * over the chains and the split R-hat of every component reach
+     * target_ess and are less than max_rhat, or n_samples samples of each
+     * chain have been recorded. Samples are stored as by run(), with as
+     * many per chain as were generated.
+     *
+     * Returns 1 if the chains converged, 0 otherwise.
+     *
+     * target_ess     : Target effective sample size
+     * max_rhat       : Largest acceptable split R-hat
+     * check_interval : Number of samples of each chain between checks
+     */
+    int run_until_converged(const double target_ess,
+                            const double max_rhat = 1.01,
+                            const int check_interval = 1000);
+    
+    /* Get samples
+     *
+     * Samples of chain i are stored column-wise in slice i, so that the
+     * cube is contiguous in memory as chains x samples x dimension.
+     * Empty unless every chain stores its samples (see
+     * MCMC::set_store_samples).
+     */
+    const arma::cube& get_samples();
+    
+private:
+    // Markov chains
+    std::vector<std::unique_ptr<MCMC>> m_chains;
+    
+    // Number of threads
+    int m_n_threads;
+    
+    // Threads the chains are run on, started by the first run
+    std::shared_ptr<ThreadPool> m_pool;
+    
+    // Samples of every chain
+    arma::cube m_samples;
+    
+    // Return the thread pool, starting it if needed
+    ThreadPool& pool();
+    
+    // Return an indicator of whether every chain stores its samples
+    int stores_samples();
+};
+
+template <class Chain>
+ChainEnsemble::ChainEnsemble(const Chain &prototype,
+                             const int n_chains,
+                             const unsigned long long seed,
+                             const int n_threads)
+    : m_n_threads{ n_threads }
+{
+    for (int i = 0; i < n_chains; ++i)
+    {
+        m_chains.emplace_back(new Chain(prototype));
+        MCMC &chain = *m_chains.back();
+        chain.set_seed(seed, i);
+        chain.set_writer(nullptr);
+        chain.set_accumulator(nullptr);
+        chain.unshare_thread_pool();
+        if (chain.get_checkpoint_interval()){
+            chain.set_checkpoint(chain.get_checkpoint_file() + "." +
+                                 std::to_string(i),
+                                 chain.get_checkpoint_interval());
+        }
+    }
+}
+
+#endif
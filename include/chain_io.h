@@ -0,0 +1,149 @@
+/* Classes for writing a Markov chain to, and reading it from, a binary file
+ *
+ * File format: a header consisting of the 8 characters "MCMCCHN1" followed
+ * by four 32-bit unsigned integers (dimension, chain id, thinning interval,
+ * bytes per value: 8 for double, 4 for float), then the samples one after
+ * another, each as dimension contiguous values. The number of samples is
+ * determined by the size of the file, so samples can be appended while the
+ * chain is generated.
+ */
+#ifndef CHAIN_IO_H
+#define CHAIN_IO_H
+
+#include <armadillo>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class ChainWriter
+{
+public:
+    /* Constructor
+     *
+     * Opens filename (truncating it) and writes the header
+     *
+     * filename         : File to write to
+     * dimension        : Dimension of the samples
+     * chain_id         : Identifier of the chain, recorded in the header
+     * thin             : Thinning interval, recorded in the header
+     * single_precision : If non-zero, store values as float rather than double
+     * block_size       : Number of samples to buffer between writes to disk
+     * append           : If non-zero and filename exists, appends samples to
+     *                    it instead (e.g. to continue a run restored from a
+     *                    checkpoint), provided it holds samples of the same
+     *                    dimension and precision
+     */
+    ChainWriter(const std::string &filename,
+                const int dimension,
+                const int chain_id = 0,
+                const int thin = 1,
+                const int single_precision = 0,
+                const int block_size = 1024,
+                const int append = 0);
+    
+    // Destructor: flushes remaining samples and closes the file
+    ~ChainWriter();
+    
+    ChainWriter(const ChainWriter&) = delete;
+    ChainWriter& operator=(const ChainWriter&) = delete;
+    
+    // Return indicator of whether the file is open
+    int is_open();
+    
+    // Append a sample (written to disk once block_size samples are buffered)
+    // Does nothing if the file isn't open
+    void write(const arma::vec &sample);
+    
+    // Write buffered samples to disk
+    void flush();
+    
+    // Flush and close the file
+    void close();
+    
+    /* Discard all but the first n_samples samples in the file
+     *
+     * Used by MCMC::load_checkpoint to discard samples written after the
+     * checkpoint. Returns 1 on success, 0 otherwise (e.g. if fewer than
+     * n_samples samples have been written).
+     *
+     * n_samples : Number of samples to keep
+     */
+    int truncate(const long long n_samples);
+    
+    // Return the number of samples written (including those buffered)
+    long long get_n_samples();
+    
+private:
+    // Output file, its name
+    std::ofstream m_file;
+    std::string m_filename;
+    
+    // Dimension, precision indicator, samples per block,
+    // number of samples buffered
+    int m_dimension, m_single_precision, m_block_size, m_n_buffered;
+    
+    // Number of samples written
+    long long m_n_samples;
+    
+    // Buffers of samples, only one of which is used
+    std::vector<double> m_buffer;
+    std::vector<float> m_buffer_float;
+    
+    // Number of bytes per sample
+    long long sample_bytes();
+    
+    /* Number of samples in an existing file to be appended to
+     *
+     * Returns -1 if the file doesn't exist, -2 if it isn't a chain of the
+     * same dimension and precision.
+     */
+    long long count_existing();
+};
+
+class ChainReader
+{
+public:
+    /* Constructor
+     *
+     * Opens filename and reads the header
+     *
+     * filename : File written by a ChainWriter
+     */
+    ChainReader(const std::string &filename);
+    
+    // Return indicator of whether the file is open and has a valid header
+    int is_open();
+    
+    // Get dimension, chain id, thinning interval
+    int get_dimension();
+    int get_chain_id();
+    int get_thin();
+    
+    // Get the number of samples in the file
+    long long get_n_samples();
+    
+    /* Read samples
+     *
+     * Reads up to n_samples of the samples not yet read (all of them if
+     * n_samples is negative), stored column-wise in samples, which are
+     * converted to double if stored as float. Returns the number read.
+     *
+     * samples   : Matrix in which to store the samples
+     * n_samples : Maximum number of samples to read
+     */
+    long long read(arma::mat &samples,
+                   const long long n_samples = -1);
+    
+private:
+    // Input file
+    std::ifstream m_file;
+    
+    // Dimension, chain id, thinning interval, bytes per value,
+    // indicator of whether the header is valid
+    int m_dimension, m_chain_id, m_thin, m_value_size, m_valid;
+    
+    // Number of samples in the file, number read so far
+    long long m_n_samples, m_n_read;
+};
+
+#endif
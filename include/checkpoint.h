@@ -0,0 +1,47 @@
+/* Functions for writing the state of a sampler to, and reading it from, a
+ * binary checkpoint
+ *
+ * Values are written in the native byte order, so a checkpoint should be
+ * resumed on the same kind of machine it was written on.
+ */
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <armadillo>
+#include <iostream>
+#include <string>
+
+// Write a value of a built-in type
+template <class T>
+void write_value(std::ostream &out,
+                 const T &x)
+{
+    out.write(reinterpret_cast<const char*>(&x), sizeof(T));
+}
+
+// Read a value of a built-in type
+template <class T>
+void read_value(std::istream &in,
+                T &x)
+{
+    in.read(reinterpret_cast<char*>(&x), sizeof(T));
+}
+
+// Write a string (its length, then its characters)
+void write_string(std::ostream &out,
+                  const std::string &s);
+
+// Read a string written by write_string
+void read_string(std::istream &in,
+                 std::string &s);
+
+// Write a matrix (or vector): its number of rows and columns, then its
+// elements in column-major order
+void write_mat(std::ostream &out,
+               const arma::mat &x);
+
+// Read a matrix (or vector) written by write_mat
+void read_mat(std::istream &in,
+              arma::mat &x);
+
+#endif
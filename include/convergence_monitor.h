@@ -0,0 +1,119 @@
+/* Class monitoring the convergence of one or more Markov chains from a
+ * stream of samples
+ *
+ * The samples of each chain are summarized by the means and sums of
+ * squared deviations of at most n_batches consecutive batches. Once
+ * n_batches batches are complete, adjacent pairs are merged, doubling the
+ * batch size, so adding a sample costs O(dimension) however long the chains
+ * become. Batch means give the effective sample size, and the first and
+ * second halves of the batches the split R-hat, of each component.
+ */
+#ifndef CONVERGENCE_MONITOR_H
+#define CONVERGENCE_MONITOR_H
+
+#include <armadillo>
+#include <vector>
+
+class ConvergenceMonitor
+{
+public:
+    /* Constructor
+     *
+     * dimension : Dimension of the samples
+     * n_chains  : Number of chains
+     * n_batches : Largest number of batches kept per chain (even). Between
+     *             n_batches/2 and n_batches batches are used in estimates.
+     */
+    ConvergenceMonitor(const int dimension = 1,
+                       const int n_chains = 1,
+                       const int n_batches = 64);
+    
+    /* Add a sample of a chain
+     *
+     * Samples of different chains may be added from different threads at
+     * once, but not while the estimates are being computed.
+     *
+     * chain : Index of the chain
+     * x     : Sample
+     */
+    void add(const int chain,
+             const arma::vec &x);
+    
+    // Reset to no samples
+    void reset();
+    
+    // Get dimension
+    int get_dimension();
+    
+    // Get number of chains
+    int get_n_chains();
+    
+    // Get number of samples added to chain i
+    long long get_n(const int chain);
+    
+    /* Get the effective sample size of each component
+     *
+     * Batch means estimates for each chain, summed over the chains. Only
+     * complete batches are used (an even number of them per chain). Chains
+     * that haven't mixed aren't detected; the split R-hat detects them.
+     * Zero until every chain has at least 4 complete batches.
+     */
+    void get_ess(arma::vec &ess);
+    
+    /* Get the split R-hat of each component
+     *
+     * Each chain is split into the first and second halves of its complete
+     * batches. Infinite until every chain has at least 4 complete batches.
+     */
+    void get_split_rhat(arma::vec &rhat);
+    
+    /* Check for convergence
+     *
+     * Returns 1 if every component has an effective sample size of at
+     * least target_ess, and a split R-hat less than max_rhat, 0 otherwise.
+     *
+     * target_ess : Target effective sample size
+     * max_rhat   : Largest acceptable split R-hat
+     */
+    int converged(const double target_ess,
+                  const double max_rhat = 1.01);
+
+private:
+    // Summary of the samples of one chain
+    struct ChainBatches
+    {
+        // Number of samples, batch size, number of complete batches,
+        // number of samples in the incomplete batch
+        long long n, batch_size;
+        int n_batches;
+        long long n_partial;
+        
+        // Means and sums of squared deviations from the mean of the
+        // complete batches (column-wise), and of the incomplete batch
+        arma::mat mean, m2;
+        arma::vec partial_mean, partial_m2;
+    };
+    
+    // Dimension, number of chains, largest number of batches per chain
+    int m_dimension, m_n_chains, m_max_batches;
+    
+    // Summaries of the chains
+    std::vector<ChainBatches> m_chains;
+    
+    // Merge adjacent pairs of the complete batches of a chain
+    void merge_batches(ChainBatches &c);
+    
+    /* Mean and variance of the samples in batches [first, first + n) of
+     * chain c
+     *
+     * mean : Mean of each component
+     * var  : Variance of each component
+     */
+    void batch_moments(const ChainBatches &c,
+                       const int first,
+                       const int n,
+                       arma::vec &mean,
+                       arma::vec &var);
+};
+
+#endif
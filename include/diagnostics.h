@@ -0,0 +1,70 @@
+/* Functions for diagnosing the convergence and efficiency of Markov chains
+ *
+ * Samples of a single chain are a dimension x n_samples matrix, as returned
+ * by MCMC::get_samples(). Samples of several chains are a
+ * dimension x n_samples x n_chains cube, as returned by
+ * ChainEnsemble::get_samples().
+ */
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <armadillo>
+
+/* Autocorrelation function of each component of a chain
+ *
+ * Computed for every lag at once using the fast Fourier transform.
+ * Returns a (max_lag+1) x dimension matrix, column i holding the
+ * autocorrelations of component i at lags 0, 1, ..., max_lag.
+ *
+ * samples : Samples of the chain
+ * max_lag : Largest lag (less than the number of samples)
+ */
+arma::mat acf(const arma::mat &samples,
+              const int max_lag);
+
+/* Effective sample size of each component of a chain
+ *
+ * Uses Geyer's initial monotone sequence estimator.
+ *
+ * samples : Samples of the chain
+ */
+arma::vec ess(const arma::mat &samples);
+
+/* Effective sample size of each component, combining several chains
+ *
+ * Autocorrelations are estimated using both the within-chain and
+ * between-chain variances, so that chains which haven't mixed have a
+ * small effective sample size (Vehtari et al., 2021).
+ *
+ * samples : Samples of the chains
+ */
+arma::vec ess(const arma::cube &samples);
+
+/* Split R-hat of each component of a chain, split into two halves
+ *
+ * samples : Samples of the chain
+ */
+arma::vec split_rhat(const arma::mat &samples);
+
+/* Split R-hat of each component, each chain split into two halves
+ *
+ * Values close to 1 (e.g. less than 1.01) suggest the chains have converged.
+ *
+ * samples : Samples of the chains
+ */
+arma::vec split_rhat(const arma::cube &samples);
+
+/* Monte Carlo standard error of the estimate of the mean of each component
+ *
+ * samples : Samples of the chain
+ */
+arma::vec mcse(const arma::mat &samples);
+
+/* Monte Carlo standard error of the estimate of the mean of each component,
+ * combining several chains
+ *
+ * samples : Samples of the chains
+ */
+arma::vec mcse(const arma::cube &samples);
+
+#endif
@@ -0,0 +1,69 @@
+/* Class adapting a step-size using Nesterov's dual averaging scheme, as
+ * in the No-U-Turn Sampler (Hoffman and Gelman, 2014)
+ */
+#ifndef DUAL_AVG_H
+#define DUAL_AVG_H
+
+#include <iostream>
+
+class DualAveraging
+{
+public:
+    /* Constructor
+     *
+     * target_accept : Target average acceptance statistic
+     * gamma         : Regularization scale
+     * t0            : Offset damping early iterations
+     * kappa         : Decay rate of the weights of the iterates averaged
+     */
+    DualAveraging(const double target_accept = 0.65,
+                  const double gamma = 0.05,
+                  const double t0 = 10.0,
+                  const double kappa = 0.75);
+    
+    // Set target average acceptance statistic
+    void set_target_accept(const double target_accept);
+    
+    // Get target average acceptance statistic
+    double get_target_accept();
+    
+    /* Restart adaptation
+     *
+     * Step-sizes are shrunk towards 10 * epsilon
+     *
+     * epsilon : Initial step-size
+     */
+    void restart(const double epsilon);
+    
+    /* Update using the acceptance statistic of the latest iteration
+     *
+     * Returns the step-size to use in the next iteration
+     *
+     * accept_stat : Acceptance probability (or average acceptance
+     *               probability over a trajectory), in [0, 1]
+     */
+    double update(double accept_stat);
+    
+    // Get the averaged step-size, to use once adaptation has finished
+    double get_final_step_size();
+    
+    // Write the state of the adaptation to a binary stream
+    void save(std::ostream &out);
+    
+    // Restore a state written by save
+    void load(std::istream &in);
+    
+private:
+    // Target, tuning parameters, log of the point step-sizes are shrunk
+    // towards
+    double m_target_accept, m_gamma, m_t0, m_kappa, m_mu;
+    
+    // Running average of the difference between target and acceptance
+    // statistic, log step-size, log of the averaged step-size
+    double m_h_bar, m_log_epsilon, m_log_epsilon_bar;
+    
+    // Number of updates since restarting
+    int m_t;
+};
+
+#endif
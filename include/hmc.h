@@ -3,8 +3,12 @@
 #ifndef HMC_H
 #define HMC_H
 
+#include "accumulator.h"
+#include "dual_avg.h"
 #include "log_post.h"
 #include "mcmc.h"
+#include "metric.h"
+#include "point.h"
 #include <armadillo>
 
 class HMC : public MCMC
@@ -54,16 +58,37 @@ public:
     // Return number of leapfrog steps (L)
     int get_n_steps();
     
-    // Return the number of accepted moves
-    int get_n_accepts();
-    
     /* Adapt the leapfrog step-size
      *
-     * Finds the largest value of epsilon = 2.00, 1.99, ..., 0.01,
-     * for which the average acceptance rate is greater than 0.65
-     * when the number of leapfrog steps is 100.
+     * Adapts epsilon during the burn-in period of the next call to hmc()
+     * (or gen_mo_est(), run() or step()) using dual averaging (Hoffman and Gelman, 2014), starting from the
+     * current step-size, so that the average acceptance probability
+     * approaches target_accept. After the burn-in period epsilon is fixed.
+     * Typically converges within a few hundred iterations of burn-in.
+     *
+     * target_accept : Target average acceptance probability
+     */
+    void adapt_step_size(const double target_accept = 0.65);
+    
+    /* Adapt the metric (mass matrix)
+     *
+     * Estimates the inverse metric from the covariance of the states visited
+     * in a series of windows of the burn-in period of the next call to
+     * hmc() (or gen_mo_est(), run() or step()), each twice the length of the previous (as in Stan). The first
+     * 15% (at most 75 iterations) and last 10% (at most 50 iterations) of
+     * burn-in are excluded, leaving the latter to adapt the step-size to
+     * the final metric (if adapt_step_size has been called).
+     *
+     * type : Metric::DIAG to estimate the marginal variances only,
+     *        Metric::DENSE to estimate the full covariance matrix
      */
-    void adapt_step_size();
+    void adapt_metric(const Metric::Type type = Metric::DIAG);
+    
+    // Set the metric
+    void set_metric(Metric metric);
+    
+    // Return the metric
+    Metric get_metric();
     
     // Generate a Markov chain using Hamiltonian Monte Carlo
     void hmc();
@@ -79,19 +104,61 @@ public:
      */
     void gen_mo_est(arma::vec &mo1_est,
                     arma::vec &mo2_est);
-private:
-    // Leapfrog step-size
-    double m_epsilon;
+protected:
+    // Leapfrog step-size, acceptance probability of the latest proposal
+    double m_epsilon, m_accept_prob;
+    
+    // Number of leapfrog steps
+    int m_L;
+    
+    // Indicator of whether to adapt the step-size during burn-in
+    int m_adapt_step_size;
     
-    // Number of leapfrog steps, number of accepted moves
-    int m_L, m_number_accepts;
+    // Step-size adaptation
+    DualAveraging m_dual_avg;
     
-    // Current and proposed velocities, gradient
-    arma::vec m_velocity_current, m_velocity_prop, m_grad;
+    // Metric
+    Metric m_metric;
+    
+    // Type of metric to adapt (Metric::UNIT if not adapting),
+    // number of burn-in iterations so far, the iteration ending the
+    // current adaptation window and the window's length
+    int m_adapt_metric, m_n_burn_iter, m_window_end, m_window_size;
+    
+    // Moments of the states in the current adaptation window
+    Accumulator m_window_acc;
+    
+    // Current and proposed velocities
+    arma::vec m_velocity_current, m_velocity_prop;
+    
+    // Current and proposed states, with the log-density and gradient
+    // at each
+    Point m_point_current, m_point_prop;
+    
+    // Markov kernel used by MCMC::run
+    int kern() override;
+    
+    // Markov kernel used by MCMC::run during burn-in, adapting the step-size
+    int burn_kern() override;
+    
+    // Fix the adapted step-size and metric
+    void end_burn() override;
+    
+    // Write / restore the step-size, metric and state of their adaptation
+    void save_state(std::ostream &out) override;
+    void load_state(std::istream &in) override;
+    
+    // Update the metric adaptation after burn-in iteration m_n_burn_iter
+    void adapt_metric_window();
     
     // Hamiltonian Monte Carlo Kernel
     // Returns an indicator of whether the proposed move was accepted or not
-    int hmc_kern();
+    virtual int hmc_kern();
+    
+    // Accept or reject the move from m_point_current, m_velocity_current
+    // to m_point_prop, m_velocity_prop, setting m_accept_prob. Returns an
+    // indicator of whether the move was accepted.
+    int accept_proposal();
 };
 
 #endif
@@ -4,9 +4,14 @@
 #define LEAPFROG_H
 
 #include "log_post.h"
+#include "metric.h"
+#include "point.h"
 #include <armadillo>
 
 /* Leapfrog transformation of state (x,v)
+ *
+ * The gradient is computed in a buffer kept by each thread between calls,
+ * so memory is only allocated when the dimension changes.
  *
  * x         : position
  * v         : velocity
@@ -20,6 +25,76 @@ void leapfrog_transform(arma::vec &x,
                         double epsilon,
                         int L);
 
+/* Leapfrog transformation of state (x,v), computing the gradient of the
+ * energy in grad (resized to the dimension of x if needed)
+ *
+ * x         : position
+ * v         : velocity
+ * posterior : LogPost object
+ * epsilon   : Step-size
+ * L         : number of steps
+ * grad      : Buffer for the gradient of the energy
+ */
+void leapfrog_transform(arma::vec &x,
+                        arma::vec &v,
+                        LogPost &posterior,
+                        double epsilon,
+                        int L,
+                        arma::vec &grad);
+
+/* Leapfrog transformation of state (z.x, v)
+ *
+ * Reuses the gradient cached in z at the initial position, and on return
+ * z holds the log-density and gradient at the final position, so that
+ * consecutive trajectories share the evaluations at their endpoints.
+ *
+ * z         : position, with the log-density and gradient at that position
+ * v         : velocity
+ * posterior : LogPost object
+ * epsilon   : Step-size
+ * L         : number of steps
+ */
+void leapfrog_transform(Point &z,
+                        arma::vec &v,
+                        LogPost &posterior,
+                        double epsilon,
+                        int L);
+
+/* Leapfrog transformation of state (z.x, v) under a metric
+ *
+ * As above, but the position moves with velocity M^{-1} v for M the metric.
+ *
+ * z         : position, with the log-density and gradient at that position
+ * v         : velocity
+ * posterior : LogPost object
+ * epsilon   : Step-size
+ * L         : number of steps
+ * metric    : Metric (mass matrix)
+ */
+void leapfrog_transform(Point &z,
+                        arma::vec &v,
+                        LogPost &posterior,
+                        double epsilon,
+                        int L,
+                        Metric &metric);
+
+/* Single leapfrog step of state (z.x, v) under a metric
+ *
+ * Uses the gradient cached in z at the initial position, and on return
+ * z holds the log-density and gradient at the final position.
+ *
+ * z         : position, with the log-density and gradient at that position
+ * v         : velocity
+ * posterior : LogPost object
+ * epsilon   : Step-size (negative to integrate backwards in time)
+ * metric    : Metric (mass matrix)
+ */
+void leapfrog_step(Point &z,
+                   arma::vec &v,
+                   LogPost &posterior,
+                   double epsilon,
+                   Metric &metric);
+
 /* Inverse leapfrog transformation of state (x,v)
  *
  * x         : position
@@ -34,4 +109,21 @@ void inv_leapfrog_transform(arma::vec &x,
                             double epsilon,
                             int L);
 
+/* Inverse leapfrog transformation of state (x,v), computing the gradient
+ * of the energy in grad (resized to the dimension of x if needed)
+ *
+ * x         : position
+ * v         : velocity
+ * posterior : LogPost object
+ * epsilon   : Step-size
+ * L         : number of steps
+ * grad      : Buffer for the gradient of the energy
+ */
+void inv_leapfrog_transform(arma::vec &x,
+                            arma::vec &v,
+                            LogPost &posterior,
+                            double epsilon,
+                            int L,
+                            arma::vec &grad);
+
 #endif
@@ -4,12 +4,113 @@
 #ifndef LOG_POST_H
 #define LOG_POST_H
 
+#include "rng.h"
 #include <armadillo>
+#include <cassert>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class ThreadPool;
+
+// Indicators of whether class T has member functions
+// double log_dens(const arma::vec& state) const
+// void grad_log_dens(const arma::vec& state, arma::vec& grad) const
+// double log_dens_and_grad(const arma::vec& state, arma::vec& grad) const
+// void batch_log_dens(const arma::mat& states, arma::vec& log_dens) const
+// void batch_grad_log_dens(const arma::mat& states, arma::mat& grads) const
+template <class T, class = void>
+struct has_log_dens : std::false_type {};
+
+template <class T>
+struct has_log_dens<T, std::void_t<decltype(
+    std::declval<const T&>().log_dens(std::declval<const arma::vec&>()))>>
+    : std::true_type {};
+
+template <class T, class = void>
+struct has_grad_log_dens : std::false_type {};
+
+template <class T>
+struct has_grad_log_dens<T, std::void_t<decltype(
+    std::declval<const T&>().grad_log_dens(std::declval<const arma::vec&>(),
+                                           std::declval<arma::vec&>()))>>
+    : std::true_type {};
+
+template <class T, class = void>
+struct has_log_dens_and_grad : std::false_type {};
+
+template <class T>
+struct has_log_dens_and_grad<T, std::void_t<decltype(
+    std::declval<const T&>().log_dens_and_grad(
+        std::declval<const arma::vec&>(), std::declval<arma::vec&>()))>>
+    : std::true_type {};
+
+template <class T, class = void>
+struct has_batch_log_dens : std::false_type {};
+
+template <class T>
+struct has_batch_log_dens<T, std::void_t<decltype(
+    std::declval<const T&>().batch_log_dens(
+        std::declval<const arma::mat&>(), std::declval<arma::vec&>()))>>
+    : std::true_type {};
+
+template <class T, class = void>
+struct has_batch_grad_log_dens : std::false_type {};
+
+template <class T>
+struct has_batch_grad_log_dens<T, std::void_t<decltype(
+    std::declval<const T&>().batch_grad_log_dens(
+        std::declval<const arma::mat&>(), std::declval<arma::mat&>()))>>
+    : std::true_type {};
 
 class LogPost
 {
 public:
+    // Functions of the state given data: the log density, the gradient of
+    // the log density (stored in grad), the Laplacian of the log density,
+    // the Hessian of the log density (stored in H)
+    using LogDensFcn = std::function<double(const arma::vec& state,
+                                            const arma::mat& data)>;
+    using GradLogDensFcn = std::function<void(const arma::vec& state,
+                                              arma::vec& grad,
+                                              const arma::mat& data)>;
+    using LaplacianLogDensFcn = std::function<double(const arma::vec& state,
+                                                     const arma::mat& data)>;
+    
+    // Functions of the state given rows first_row, ..., last_row of data:
+    // the log-likelihood of those rows, and its gradient (stored in grad)
+    using BlockLogLikFcn = std::function<double(const arma::vec& state,
+                                                const arma::mat& data,
+                                                int first_row,
+                                                int last_row)>;
+    using BlockGradLogLikFcn = std::function<void(const arma::vec& state,
+                                                  arma::vec& grad,
+                                                  const arma::mat& data,
+                                                  int first_row,
+                                                  int last_row)>;
+    
+    // Functions of many states (the columns of states) given data: storing
+    // the log density at each in log_dens, the gradient at each in the
+    // columns of grads
+    using BatchLogDensFcn = std::function<void(const arma::mat& states,
+                                               arma::vec& log_dens,
+                                               const arma::mat& data)>;
+    using BatchGradLogDensFcn = std::function<void(const arma::mat& states,
+                                                   arma::mat& grads,
+                                                   const arma::mat& data)>;
+    using HessianLogDensFcn = std::function<void(const arma::vec& state,
+                                                 arma::mat& H,
+                                                 const arma::mat& data)>;
+    
+    // Function returning the log density at state given data, and storing
+    // the gradient of the log density in grad
+    using LogDensAndGradFcn = std::function<double(const arma::vec& state,
+                                                   arma::vec& grad,
+                                                   const arma::mat& data)>;
+    
     /* Constructor
      *
      * dimension : Dimension of the posterior
@@ -66,9 +167,97 @@ public:
             double (*laplacian_log_dens)(const arma::vec& state,
                                          const arma::mat& data));
     
-    // Sets Data
+    /* Constructor
+     *
+     * Shares data with any other LogPost objects (and copies of this
+     * object) holding the same pointer, rather than copying it. To use data
+     * owned elsewhere, pass a pointer with a deleter that does nothing.
+     *
+     * dimension          : Dimension of the posterior
+     * data               : Pointer to the data passed to the posterior
+     * log_dens           : Function returning the log-density of the posterior
+     *                      at state given data
+     * grad_log_dens      : (Optional) Function to compute the gradient of the
+     *                      log-density at state given data then store in
+     *                      argument grad
+     * laplacian_log_dens : (Optional) Function returning the Laplacian of the
+     *                      log-density at state given data
+     */
+    LogPost(int dimension,
+            std::shared_ptr<const arma::mat> data,
+            double (*log_dens)(const arma::vec& state,
+                               const arma::mat& data),
+            void (*grad_log_dens)(const arma::vec& state,
+                                  arma::vec& grad,
+                                  const arma::mat& data) = nullptr,
+            double (*laplacian_log_dens)(const arma::vec& state,
+                                         const arma::mat& data) = nullptr);
+    
+    /* Constructor
+     *
+     * Accepts any callable objects, such as lambdas capturing the state
+     * the density needs. Data may be given afterwards using set_data.
+     *
+     * dimension     : Dimension of the posterior
+     * log_dens      : Function returning the log-density of the posterior at
+     *                 state given data
+     * grad_log_dens : (Optional) Function to compute the gradient of the
+     *                 log-density at state given data then store in argument
+     *                 grad
+     */
+    LogPost(int dimension,
+            LogDensFcn log_dens,
+            GradLogDensFcn grad_log_dens = nullptr);
+    
+    /* Constructor
+     *
+     * Target is a class with member function
+     *     double log_dens(const arma::vec& state) const
+     * and, optionally,
+     *     void grad_log_dens(const arma::vec& state, arma::vec& grad) const
+     *     double log_dens_and_grad(const arma::vec& state,
+     *                              arma::vec& grad) const
+     *     void batch_log_dens(const arma::mat& states,
+     *                         arma::vec& log_dens) const
+     *     void batch_grad_log_dens(const arma::mat& states,
+     *                              arma::mat& grads) const
+     * so that anything the density needs (such as a precomputed Cholesky
+     * factor) is held by the target rather than packed into a data matrix.
+     * Each call to the target still goes through a std::function; samplers
+     * that call the target's member functions directly, so that they may
+     * be inlined into the kernel, are TargetRWM (include/target_rwm.h) and
+     * TargetHMC (include/target_hmc.h). Copies of this object share the
+     * target.
+     *
+     * dimension : Dimension of the posterior
+     * target    : The target density
+     */
+    template <class Target,
+              class = std::enable_if_t<has_log_dens<Target>::value>>
+    LogPost(int dimension,
+            Target target);
+    
+    /* Constructor
+     *
+     * As above, sharing target with its other owners rather than copying it
+     *
+     * dimension : Dimension of the posterior
+     * target    : Pointer to the target density
+     */
+    template <class Target,
+              class = std::enable_if_t<has_log_dens<Target>::value>>
+    LogPost(int dimension,
+            std::shared_ptr<const Target> target);
+    
+    // Sets Data (copies data)
     void set_data(const arma::mat& data);
     
+    // Sets Data, sharing it rather than copying it
+    void set_data(std::shared_ptr<const arma::mat> data);
+    
+    // Returns a pointer to the data, which may be shared with other objects
+    std::shared_ptr<const arma::mat> get_data();
+    
     // Sets the log density
     void set_log_dens(double (*log_dens)(const arma::vec& state,
                                          const arma::mat& data));
@@ -83,6 +272,76 @@ public:
                                 (const arma::vec& state,
                                  const arma::mat& data));
     
+    /* Sets a function evaluating the log density and its gradient together
+     *
+     * Optional: when the log density and gradient share expensive
+     * computations (such as the linear predictor of a regression), this
+     * is used wherever both are needed at the same state.
+     *
+     * log_dens_and_grad : Function returning the log-density of the
+     *                     posterior at state given data and storing the
+     *                     gradient in argument grad
+     */
+    void set_log_dens_and_grad(LogDensAndGradFcn log_dens_and_grad);
+    
+    /* Sets functions evaluating the log density / gradient at many states
+     *
+     * Optional: evaluating many states in one call lets matrix-vector
+     * products with the data become a single matrix-matrix product.
+     * Otherwise batch_log_dens and batch_grad_log_dens loop over the
+     * states.
+     *
+     * batch_log_dens      : Function storing the log-density at each column
+     *                       of states given data in argument log_dens
+     * batch_grad_log_dens : Function storing the gradient of the
+     *                       log-density at each column of states given data
+     *                       in the columns of argument grads
+     */
+    void set_batch_log_dens(BatchLogDensFcn batch_log_dens);
+    void set_batch_grad_log_dens(BatchGradLogDensFcn batch_grad_log_dens);
+    
+    /* Sets the log density to a sum over the rows of the data
+     *
+     * The log density becomes log_prior(state) plus the sum of log_lik over
+     * consecutive blocks of rows of the data, evaluated in parallel by a
+     * pool of threads (shared with copies of this object). Blocks depend
+     * only on the number of rows and block_size, and are summed in order,
+     * so results don't depend on the number of threads. Set the data
+     * first. log_lik and grad_log_lik are called from several threads at
+     * once, so must not modify shared state. The pool is shared with copies
+     * of this object, whose evaluations then take turns on it, so copies
+     * used by chains running in parallel should be given their own pools
+     * with unshare_thread_pool (as ChainEnsemble does).
+     *
+     * log_lik        : Function returning the log-likelihood of rows
+     *                  first_row to last_row (inclusive) of data at state
+     * grad_log_lik   : (Optional) Function to compute the gradient of the
+     *                  log-likelihood of rows first_row to last_row of data
+     *                  at state then store in argument grad
+     * log_prior      : (Optional) Function returning the log prior at state
+     * grad_log_prior : (Optional) Function to compute the gradient of the
+     *                  log prior at state then store in argument grad
+     * n_threads      : Number of threads. If not positive, uses the number
+     *                  of hardware threads.
+     * block_size     : Number of rows per block. If not positive, the rows
+     *                  are split into (at most) 256 blocks.
+     */
+    void set_sum_log_lik(BlockLogLikFcn log_lik,
+                         BlockGradLogLikFcn grad_log_lik = nullptr,
+                         LogDensFcn log_prior = nullptr,
+                         GradLogDensFcn grad_log_prior = nullptr,
+                         int n_threads = 0,
+                         int block_size = 0);
+    
+    /* Start a pool of threads used by this object alone
+     *
+     * For a log density set by set_sum_log_lik, replaces the pool shared
+     * with copies of this object by one with as many threads, so that
+     * copies can evaluate the log density at the same time. Otherwise does
+     * nothing.
+     */
+    void unshare_thread_pool();
+    
     /* Transform the density
      *
      * Allows computation of the transformed density and gradient
@@ -129,6 +388,9 @@ public:
     int is_log_dens_constructed();
     int is_grad_log_dens_constructed();
     int is_laplacian_log_dens_constructed();
+    int is_log_dens_and_grad_constructed();
+    int is_batch_log_dens_constructed();
+    int is_batch_grad_log_dens_constructed();
     
     // Log density at state
     double log_dens(const arma::vec& state);
@@ -140,47 +402,210 @@ public:
     void update_grad_log_dens(const arma::vec& state,
                               arma::vec& grad);
     
+    // Log density at state, also updating grad, the gradient of the log
+    // density at state. Uses the combined function if one has been set.
+    double log_dens_and_grad(const arma::vec& state,
+                             arma::vec& grad);
+    
+    /* Estimate the gradient of the log density at state from a minibatch
+     *
+     * For a log density that is a sum over rows of data (see
+     * set_sum_log_lik, which must have been given grad_log_lik), estimates
+     * the sum from batch_size rows drawn uniformly with replacement, scaled
+     * to all N rows, so that the cost is proportional to batch_size. The
+     * estimate is unbiased. If a control variate has been set, at anchor
+     * x0, it is the full gradient at x0 plus the estimate of the difference
+     * between the gradients at state and at x0, which has much lower
+     * variance near x0. Not counted as an evaluation of the gradient.
+     *
+     * state      : State at which to estimate the gradient
+     * grad       : The estimate
+     * generator  : Random number generator used to draw rows
+     * batch_size : Number of rows drawn
+     */
+    void update_minibatch_grad_log_dens(const arma::vec& state,
+                                        arma::vec& grad,
+                                        Rng& generator,
+                                        int batch_size);
+    
+    /* Use control variates in minibatch gradient estimates
+     *
+     * Computes the full gradient at the anchor once, with all rows.
+     *
+     * anchor : State near a mode of the density
+     */
+    void set_control_variate(const arma::vec& anchor);
+    
+    // Use control variates anchored at the mean of the Laplace
+    // Approximation (the density must have been transformed)
+    void set_control_variate();
+    
+    // Stop using control variates
+    void unset_control_variate();
+    
     // Update grad_U, the gradient of the energy at state
     void update_grad_U(const arma::vec& state,
                        arma::vec& grad);
     
+    // Log density at each column of states, stored in log_dens
+    void batch_log_dens(const arma::mat& states,
+                        arma::vec& log_dens);
+    
+    // Gradient of the log density at each column of states, stored in the
+    // columns of grads
+    void batch_grad_log_dens(const arma::mat& states,
+                             arma::mat& grads);
+    
     // Laplacian of the log density at state
     double laplacian_log_dens(const arma::vec& state);
     
     // Laplacian of the energy at state
     double laplacian_U(const arma::vec& state);
     
+    // Return the number of evaluations of the log density / gradient of
+    // the log density made so far
+    long long get_n_log_dens_evals();
+    long long get_n_grad_log_dens_evals();
+    
+    // Reset the counts of evaluations to zero
+    void reset_n_evals();
+    
 private:
-    // Data, Laplace approximation Covariance matrix, transformation matrix
-    arma::mat m_data, m_la_cov, m_tf_mat;
+    // Data, which is immutable so that it can be shared between copies
+    // of the object (and between threads) without being copied
+    std::shared_ptr<const arma::mat> m_data;
+    
+    // Laplace approximation Covariance matrix, transformation matrix
+    arma::mat m_la_cov, m_tf_mat;
     
     // Laplace approximation mean
     arma::vec m_la_mean;
     
+    // Workspace for the transformed density: the untransformed state and
+    // the gradient with respect to it
+    arma::vec m_orig_state, m_orig_grad;
+    
     // Dimension, indicators of whether
-    // data/ m_log_dens/m_grad_log_dens/m_laplacian_log_dens
-    // has been constructed, indicator of whether to transform the density
+    // data/ m_log_dens/m_grad_log_dens/m_laplacian_log_dens/
+    // m_log_dens_and_grad/m_batch_log_dens/m_batch_grad_log_dens has been
+    // constructed, indicator of whether to transform the density
     int m_dimension, m_log_dens_constructed, m_data_constructed,
         m_grad_log_dens_constructed, m_laplacian_log_dens_constructed,
-        m_transform_density;
+        m_log_dens_and_grad_constructed, m_batch_log_dens_constructed,
+        m_batch_grad_log_dens_constructed, m_transform_density;
+    
+    // Indicator of whether the log density is a sum over rows of data,
+    // number of rows per block requested (if positive) and used,
+    // indicator of whether minibatch gradients use control variates
+    int m_sum_log_lik_constructed, m_block_size, m_block_rows,
+        m_control_variate;
+    
+    // Number of evaluations of the log density / gradient of the log density
+    long long m_n_log_dens_evals, m_n_grad_log_dens_evals;
+    
+    // Log density / gradient of the log density of the posterior when
+    // given as plain functions (otherwise nullptr), which are called
+    // directly rather than through m_log_dens / m_grad_log_dens
+    double (*m_log_dens_ptr)(const arma::vec& state,
+                             const arma::mat& data);
+    void (*m_grad_log_dens_ptr)(const arma::vec& state,
+                                arma::vec& grad,
+                                const arma::mat& data);
     
     // Log density of the posterior
-    double (*m_log_dens)(const arma::vec& state,
-                         const arma::mat& data);
+    LogDensFcn m_log_dens;
     
     // Gradient of the log density of the posterior
-    void (*m_grad_log_dens)(const arma::vec& state,
-                            arma::vec& grad,
-                            const arma::mat& data);
+    GradLogDensFcn m_grad_log_dens;
     
     // Laplacian of the log density of the posterior
-    double (*m_laplacian_log_dens)(const arma::vec& state,
-                                   const arma::mat& data);
+    LaplacianLogDensFcn m_laplacian_log_dens;
     
     // Hessian of the log density with respect to the state
-    void (*m_hessian_log_dens)(const arma::vec& state,
-                               arma::mat& H,
-                               const arma::mat& data);
+    HessianLogDensFcn m_hessian_log_dens;
+    
+    // Log density and its gradient, evaluated together
+    LogDensAndGradFcn m_log_dens_and_grad;
+    
+    // Log density / gradient of the log density at many states
+    BatchLogDensFcn m_batch_log_dens;
+    BatchGradLogDensFcn m_batch_grad_log_dens;
+    
+    // Log-likelihood of a block of rows / its gradient, log prior / its
+    // gradient, for a log density that is a sum over rows of data
+    BlockLogLikFcn m_block_log_lik;
+    BlockGradLogLikFcn m_block_grad_log_lik;
+    LogDensFcn m_log_prior;
+    GradLogDensFcn m_grad_log_prior;
+    
+    // Anchor of the control variates, full gradient of the log likelihood
+    // there (both untransformed), gradient of a single row
+    arma::vec m_cv_anchor, m_cv_grad, m_row_grad;
+    
+    // Threads evaluating blocks of rows
+    std::shared_ptr<ThreadPool> m_pool;
+    
+    // Log-likelihood of each block of rows, gradient of each (by column)
+    std::vector<double> m_block_values;
+    arma::mat m_block_grads;
+    
+    // Workspace for batches of transformed states: the untransformed states
+    // and the gradients with respect to them
+    arma::mat m_orig_states, m_orig_grads;
+    
+    // Log density / gradient of the log density at untransformed state x
+    double eval_log_dens(const arma::vec& x);
+    void eval_grad_log_dens(const arma::vec& x,
+                            arma::vec& grad);
+    
+    // Number of rows of data
+    int n_data_rows();
+    
+    // Set m_block_rows and return the number of blocks of rows
+    int get_n_blocks();
 };
 
+template <class Target, class>
+LogPost::LogPost(int dimension,
+                 Target target)
+    : LogPost(dimension, std::shared_ptr<const Target>(
+          std::make_shared<const Target>(std::move(target))))
+{
+}
+
+template <class Target, class>
+LogPost::LogPost(int dimension,
+                 std::shared_ptr<const Target> t)
+    : LogPost(dimension)
+{
+    assert(t);
+    m_log_dens = [t](const arma::vec& state, const arma::mat&)
+                 { return t->log_dens(state); };
+    m_log_dens_constructed = 1;
+    if constexpr (has_grad_log_dens<Target>::value){
+        m_grad_log_dens = [t](const arma::vec& state, arma::vec& grad,
+                              const arma::mat&)
+                          { t->grad_log_dens(state, grad); };
+        m_grad_log_dens_constructed = 1;
+    }
+    if constexpr (has_log_dens_and_grad<Target>::value){
+        m_log_dens_and_grad = [t](const arma::vec& state, arma::vec& grad,
+                                  const arma::mat&)
+                              { return t->log_dens_and_grad(state, grad); };
+        m_log_dens_and_grad_constructed = 1;
+    }
+    if constexpr (has_batch_log_dens<Target>::value){
+        m_batch_log_dens = [t](const arma::mat& states, arma::vec& ld,
+                               const arma::mat&)
+                           { t->batch_log_dens(states, ld); };
+        m_batch_log_dens_constructed = 1;
+    }
+    if constexpr (has_batch_grad_log_dens<Target>::value){
+        m_batch_grad_log_dens = [t](const arma::mat& states, arma::mat& grads,
+                                    const arma::mat&)
+                                { t->batch_grad_log_dens(states, grads); };
+        m_batch_grad_log_dens_constructed = 1;
+    }
+}
+
 #endif
@@ -0,0 +1,106 @@
+/* Class representing a Markov chain generated using the Metropolis-adjusted
+ * Langevin Algorithm (Roberts and Tweedie, 1996)
+ */
+#ifndef MALA_H
+#define MALA_H
+
+#include "dual_avg.h"
+#include "log_post.h"
+#include "mcmc.h"
+#include "point.h"
+#include <armadillo>
+
+class MALA : public MCMC
+{
+public:
+    /* Default Constructor
+     *
+     * burn      : The burn-in period
+     * thin      : Thinning interval
+     * n_samples : Number of (thinned) samples to generate
+     * epsilon   : Step-size, the standard deviation of the proposal
+     */
+    MALA(const int burn = 10000,
+         const int thin = 1,
+         const int n_samples = 10000,
+         const double epsilon = 0.1);
+    
+    /* Constructor
+     *
+     * log_post      : The log posterior
+     * initial_state : The initial state
+     * burn          : The burn-in period
+     * thin          : Thinning interval
+     * n_samples     : Number of (thinned) samples to generate
+     * epsilon       : Step-size, the standard deviation of the proposal
+     */
+    MALA(LogPost log_post,
+         const arma::vec &initial_state,
+         const int burn,
+         const int thin,
+         const int n_samples,
+         const double epsilon = 0.1);
+    
+    // Set step size (epsilon)
+    void set_step_size(double epsilon);
+    
+    // Return step size (epsilon)
+    double get_step_size();
+    
+    /* Adapt the step-size
+     *
+     * Adapts epsilon by dual averaging during the burn-in period of the next
+     * call to mala(), so that the average acceptance probability approaches
+     * target_accept (0.574 is optimal for high-dimensional targets). After
+     * the burn-in period epsilon is fixed.
+     *
+     * target_accept : Target average acceptance probability
+     */
+    void adapt_step_size(const double target_accept = 0.574);
+    
+    // Generate a Markov chain using the Metropolis-adjusted Langevin
+    // Algorithm
+    void mala();
+    
+private:
+    // Step-size, acceptance probability of the latest proposal
+    double m_epsilon, m_accept_prob;
+    
+    // Indicator of whether to adapt the step-size during burn-in
+    int m_adapt_step_size;
+    
+    // Step-size adaptation
+    DualAveraging m_dual_avg;
+    
+    // Current and proposed states, with the log-density and gradient
+    // at each
+    Point m_point_current, m_point_prop;
+    
+    // Gaussian noise, workspace
+    arma::vec m_noise, m_work;
+    
+    // Markov kernel used by MCMC::run
+    int kern() override;
+    
+    // Markov kernel used by MCMC::run during burn-in, adapting the step-size
+    int burn_kern() override;
+    
+    // Fix the adapted step-size
+    void end_burn() override;
+    
+    // Write / restore the step-size and its adaptation
+    void save_state(std::ostream &out) override;
+    void load_state(std::istream &in) override;
+    
+    // Log density (up to a constant) of proposing state to given from,
+    // which has gradient grad_from
+    double log_prop_dens(const arma::vec &to,
+                         const arma::vec &from,
+                         const arma::vec &grad_from);
+    
+    // Metropolis-adjusted Langevin kernel
+    // Returns an indicator of whether the proposed move was accepted or not
+    int mala_kern();
+};
+
+#endif
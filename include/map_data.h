@@ -0,0 +1,52 @@
+/* Functions to memory-map data stored in binary files
+ *
+ * The data are returned as a read-only arma::mat using the mapped memory
+ * directly, which can be passed to LogPost without being copied. Pages of
+ * the file are only read from disk when first accessed, and processes
+ * mapping the same file share the operating system's page cache.
+ */
+#ifndef MAP_DATA_H
+#define MAP_DATA_H
+
+#include <armadillo>
+#include <memory>
+#include <string>
+
+/* Memory-map a matrix of doubles stored in column-major order, without a
+ * header (as written by arma::mat::save(filename, arma::raw_binary))
+ *
+ * Returns a null pointer if the file can't be mapped.
+ *
+ * filename : File to map
+ * n_rows   : Number of rows of the matrix
+ * n_cols   : Number of columns of the matrix
+ */
+std::shared_ptr<const arma::mat> map_raw_binary(const std::string &filename,
+                                                const arma::uword n_rows,
+                                                const arma::uword n_cols);
+
+/* Memory-map a matrix of doubles stored in Armadillo's binary format
+ *
+ * The header's length depends on the size of the matrix, so the matrix
+ * is only aligned for reading doubles in place when the header is padded,
+ * as by save_arma_binary. Files written by arma::mat::save(filename,
+ * arma::arma_binary) usually aren't, and are rejected rather than copied
+ * into memory. Returns a null pointer if the file can't be mapped.
+ *
+ * filename : File to map
+ */
+std::shared_ptr<const arma::mat> map_arma_binary(const std::string &filename);
+
+/* Save a matrix in Armadillo's binary format, padding the header so that
+ * the file can be memory-mapped by map_arma_binary
+ *
+ * The file can still be read by arma::mat::load.
+ * Returns 1 if the file was written, 0 otherwise.
+ *
+ * x        : Matrix to save
+ * filename : File to write
+ */
+int save_arma_binary(const arma::mat &x,
+                     const std::string &filename);
+
+#endif
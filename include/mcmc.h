@@ -1,16 +1,31 @@
 #ifndef MCMC_H
 #define MCMC_H
 
+#include "accumulator.h"
+#include "chain_io.h"
+#include "convergence_monitor.h"
 #include "log_post.h"
 #include "print.h"
+#include "rng.h"
 #include <armadillo>
 #include <fstream>
+#include <functional>
+#include <iostream>
 #include <random>
+#include <string>
 #include <vector>
 
 class MCMC
 {
 public:
+    /* Function receiving a chunk of consecutive samples
+     *
+     * samples : Samples, stored column-wise (only valid during the call)
+     * first   : Index of the first sample of the chunk within the chain
+     */
+    using SampleSink = std::function<void(const arma::mat& samples,
+                                          const int first)>;
+    
     /* Constructor
      *
      * burn      : Burn-in period
@@ -35,6 +50,8 @@ public:
          const int thin = 1,
          const int n_samples = 10000);
     
+    virtual ~MCMC();
+    
     // Set the initial state
     void set_init_state(const arma::vec &initial_state);
     
@@ -54,6 +71,144 @@ public:
     // Should only be called once, before any random numbers are generated
     void set_seed(const unsigned int s);
     
+    /* Set seed and stream
+     *
+     * Seeds the random number generator from both s and stream, so that
+     * chains sharing a seed but given different streams use different
+     * sequences of random numbers.
+     * Should only be called once, before any random numbers are generated
+     *
+     * s      : Seed
+     * stream : Stream (e.g. the index of a chain)
+     */
+    void set_seed(const unsigned long long s,
+                  const unsigned int stream);
+    
+    /* Set the type of random number generator
+     *
+     * Rng::PHILOX (the default), a counter-based generator, or
+     * Rng::MT19937. With Rng::PHILOX, the random numbers used by the n-th
+     * application of the Markov kernel depend only on the seed, the stream
+     * and n, so can be reproduced without replaying earlier iterations.
+     * Keeps the latest seed, so may be called before or after set_seed.
+     *
+     * type : Type of generator
+     */
+    void set_rng(const Rng::Type type);
+    
+    // Give the posterior its own pool of threads, rather than sharing it
+    // with copies of the chain (see LogPost::unshare_thread_pool)
+    void unshare_thread_pool();
+    
+    /* Stream samples to a binary file as they are generated
+     *
+     * The writer isn't owned by the chain, so must outlive calls to run().
+     * Pass nullptr to stop streaming. A copy of a chain shares the writer,
+     * so give each copy its own (ChainEnsemble clears it on its copies).
+     *
+     * writer : ChainWriter to pass each sample to
+     */
+    void set_writer(ChainWriter *writer);
+    
+    /* Accumulate estimates of moments from samples as they are generated
+     *
+     * As with set_writer, the accumulator isn't owned by the chain.
+     * Pass nullptr to stop accumulating.
+     *
+     * accumulator : Accumulator to add each sample to
+     */
+    void set_accumulator(Accumulator *accumulator);
+    
+    /* Monitor convergence from samples as they are generated
+     *
+     * As with set_writer, the monitor isn't owned by the chain. Pass
+     * nullptr to stop monitoring.
+     *
+     * monitor : ConvergenceMonitor to add each sample to
+     * chain   : Index of this chain within the monitor
+     */
+    void set_monitor(ConvergenceMonitor *monitor,
+                     const int chain = 0);
+    
+    /* Pass samples to a function, in chunks, as they are generated
+     *
+     * A chunk is passed once chunk_size samples have been recorded, and at
+     * the end of each call to step() or run(). Pass nullptr to stop. A
+     * chain copied (e.g. by ChainEnsemble) shares the sink, which may then
+     * be called from several threads at once.
+     *
+     * sink       : Function to pass each chunk of samples to
+     * chunk_size : Largest number of samples in a chunk
+     */
+    void set_sink(SampleSink sink,
+                  const int chunk_size = 1000);
+    
+    // Set indicator of whether to store samples in memory (the default).
+    // When streaming to a ChainWriter, set to 0 to use constant memory.
+    void set_store_samples(const int store_samples);
+    
+    /* Store samples in memory owned by the caller
+     *
+     * Samples are stored column-wise at memory, which must hold
+     * dimension x n_samples values and outlive calls to run(), instead of
+     * in memory allocated by the chain (e.g. in a slice of a cube holding
+     * the samples of several chains). get_samples() then returns an empty
+     * matrix. Samples already recorded in a run in progress are moved
+     * there, and back when memory is nullptr (the default). A copy of a
+     * chain shares the memory, so give each copy its own.
+     *
+     * memory : Memory to store samples in, or nullptr
+     */
+    void set_sample_memory(double *memory);
+    
+    /* Write checkpoints while generating the chain
+     *
+     * Every interval applications of the Markov kernel, run() writes all
+     * that is needed to continue the chain to filename. Each checkpoint is
+     * written to filename.tmp, which then replaces filename, so a run
+     * interrupted while writing leaves the previous checkpoint intact.
+     * An interval of 0 (the default) disables checkpoints.
+     *
+     * filename : Checkpoint file
+     * interval : Number of applications of the Markov kernel between
+     *            checkpoints
+     */
+    void set_checkpoint(const std::string &filename,
+                        const int interval);
+    
+    /* Restore the chain from a checkpoint
+     *
+     * The chain should be set up as it was for the run that wrote the
+     * checkpoint (posterior, burn-in, thinning, number of samples, tuning
+     * parameters and any functions added to the accumulator). Restores the
+     * state of the chain, including the random number generator and any
+     * adapted tuning parameters, so that step() or run() continue from the
+     * checkpoint and, for a given seed, generate the same samples as an
+     * uninterrupted run. Samples recorded before the checkpoint are
+     * restored when stored in memory, but aren't passed to the sink. To
+     * continue streaming, set a writer opened in append mode on the file
+     * the run was streamed to before calling load_checkpoint; samples it
+     * holds from after the checkpoint are discarded, so the file ends up
+     * identical to that of an uninterrupted run.
+     *
+     * Returns 1 if the checkpoint was read, 0 otherwise.
+     *
+     * filename : Checkpoint file written by run() or step()
+     */
+    int load_checkpoint(const std::string &filename);
+    
+    // Restore the chain from a checkpoint, then finish generating it with
+    // run(). Returns 1 if the checkpoint was read, 0 otherwise.
+    int resume(const std::string &filename);
+    
+    // Get indicator of whether samples are stored in memory
+    int get_store_samples();
+    
+    // Get checkpoint file, number of applications of the Markov kernel
+    // between checkpoints (0 if none are written)
+    std::string get_checkpoint_file();
+    int get_checkpoint_interval();
+    
     // Get burn-in period
     int get_burn();
     
@@ -66,12 +221,33 @@ public:
     // Get dimension
     int get_dimension();
     
+    // Return the number of accepted moves
+    int get_n_accepts();
+    
+    // Return the number of applications of the Markov kernel so far
+    unsigned long long get_iteration();
+    
+    // Return the number of samples recorded so far in the current run
+    int get_n_recorded();
+    
+    // Return an indicator of whether a run has been started (by step() or
+    // load_checkpoint()) but not yet finished
+    int is_running();
+    
     // Get current state
     void get_current_state(arma::vec &state);
     
-    // Get samples
+    // Get the number of evaluations of the log density / gradient of the
+    // log density of the posterior made by the chain so far
+    long long get_n_log_dens_evals();
+    long long get_n_grad_log_dens_evals();
+    
+    // Get samples (copies each sample into a separate arma::vec)
     void get_samples(std::vector<arma::vec> &samples);
     
+    // Get samples, stored column-wise in a dimension x n_samples matrix
+    const arma::mat& get_samples();
+    
     /* Estimate moments
      *
      * Estimate the first and second moments of the distribution from the
@@ -83,6 +259,53 @@ public:
     void est_moments(arma::vec &mo1_est,
                      arma::vec &mo2_est);
     
+    /* Generate the Markov chain
+     *
+     * Applies the Markov kernel burn times, then records n_samples samples,
+     * applying the kernel thin times between consecutive samples. If a run
+     * is in progress, finishes it.
+     */
+    void run();
+    
+    /* Advance the chain by up to n applications of the Markov kernel
+     *
+     * Follows the same schedule as run() (burn-in, then a sample every
+     * thin applications), starting a new run if none is in progress, so
+     * that a chain can be generated in pieces, watched, or interleaved with
+     * other chains. Samples are recorded as by run(), and passed to the
+     * sink at the end of the call. Once n_samples samples have been
+     * recorded the run is finished, as by finish().
+     *
+     * Returns the number of samples recorded during the call.
+     *
+     * n : Number of applications of the Markov kernel
+     */
+    int step(const long long n);
+    
+    // Finish the current run, possibly early: samples stored in memory are
+    // truncated to those recorded so far, and the writer is flushed
+    void finish();
+    
+    /* Generate the Markov chain until it has converged
+     *
+     * After burn-in, checks the batch means effective sample size and split
+     * R-hat of every component (see ConvergenceMonitor) every check_interval
+     * samples, and finishes the run once each reaches target_ess and is
+     * less than max_rhat, or once n_samples samples have been recorded. If
+     * a run is in progress (e.g. restored by load_checkpoint), continues it,
+     * taking account of the samples already stored in memory. A monitor
+     * set with set_monitor isn't passed samples during the call.
+     *
+     * Returns 1 if the chain converged, 0 otherwise.
+     *
+     * target_ess     : Target effective sample size
+     * max_rhat       : Largest acceptable split R-hat
+     * check_interval : Number of samples between checks
+     */
+    int run_until_converged(const double target_ess,
+                            const double max_rhat = 1.01,
+                            const int check_interval = 1000);
+    
     // Print the current state of the Markov chain
     void print_current();
     
@@ -93,22 +316,109 @@ public:
     void print_chain(std::ofstream& file);
     
 protected:
+    // Apply the Markov kernel once to m_current
+    // Returns an indicator of whether the proposed move was accepted or not
+    virtual int kern() = 0;
+    
+    // Apply the Markov kernel once during the burn-in period, during which
+    // a subclass may also adapt its tuning parameters. Defaults to kern().
+    virtual int burn_kern();
+    
+    // Called by run() once the burn-in period is over, e.g. for a subclass
+    // to fix its adapted tuning parameters. Defaults to doing nothing.
+    virtual void end_burn();
+    
+    // Write the state of a subclass (e.g. adapted tuning parameters) to a
+    // checkpoint, and restore it. Default to doing nothing.
+    virtual void save_state(std::ostream &out);
+    virtual void load_state(std::istream &in);
+    
+    // Apply burn_kern() (if burn_in is non-zero) or kern() as iteration
+    // m_iteration, then increment m_iteration
+    int apply_kern(const int burn_in);
+    
+    // Record m_current as sample i (in memory, via m_writer, m_accumulator,
+    // m_monitor and/or m_sink)
+    void record_sample(const int i);
+    
+    // Start a new run
+    void start_run();
+    
+    // Number of applications of the Markov kernel in a complete run
+    long long run_length();
+    
+    // Called once m_run_iteration applications of the Markov kernel in the
+    // current run are complete: ends the burn-in period and records samples
+    void complete_iteration();
+    
+    // Pass the samples in m_chunk to the sink
+    void flush_chunk();
+    
+    // Write a checkpoint to m_checkpoint_file
+    void write_checkpoint();
+    
+    // Return the location of the samples recorded so far
+    double* recorded_samples();
+    
     // Random number generator
-    std::mt19937_64 m_gen;
+    Rng m_gen;
     
     // Posterior distribution of interest
     LogPost m_posterior;
     
     // Burn in (should be a multiple of 100), thinning interval,
     // number of samples, dimension,
-    // indication of whether samples have been generated.
-    int m_burn, m_thin, m_number_samples, m_dimension, m_samples_generated;
+    // indication of whether samples have been generated,
+    // indication of whether evaluations of the posterior cached by a
+    // subclass at m_current are still valid.
+    int m_burn, m_thin, m_number_samples, m_dimension, m_samples_generated,
+        m_current_cached;
+    
+    // Number of accepted moves
+    int m_number_accepts;
+    
+    // Number of applications of the Markov kernel so far
+    unsigned long long m_iteration;
+    
+    // Number of applications of the Markov kernel so far in the current
+    // run, indicator of whether a run is in progress, number of samples
+    // recorded in the current run
+    long long m_run_iteration;
+    int m_running, m_n_recorded;
+    
+    // Checkpoint file, number of applications of the Markov kernel between
+    // checkpoints (0 if none are written)
+    std::string m_checkpoint_file;
+    int m_checkpoint_interval;
+    
+    // Indicator of whether to store samples in m_samples
+    int m_store_samples;
+    
+    // Writer samples are streamed to (if not nullptr)
+    ChainWriter *m_writer;
+    
+    // Accumulator samples are added to (if not nullptr)
+    Accumulator *m_accumulator;
+    
+    // Monitor samples are added to (if not nullptr), index of the chain
+    // within it
+    ConvergenceMonitor *m_monitor;
+    int m_monitor_chain;
+    
+    // Function chunks of samples are passed to (if set), samples not yet
+    // passed to it (stored column-wise), number of them
+    SampleSink m_sink;
+    arma::mat m_chunk;
+    int m_n_chunk;
     
     // Initial, current and proposal states
     arma::vec m_initial_state, m_current, m_prop;
     
-    // Vector of samples
-    std::vector<arma::vec> m_samples;
+    // Samples, stored column-wise in a dimension x n_samples matrix
+    arma::mat m_samples;
+    
+    // Memory samples are stored in instead of m_samples (if not nullptr)
+    double *m_sample_memory;
 };
 
 #endif
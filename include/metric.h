@@ -0,0 +1,84 @@
+/* Class representing the metric (mass matrix) M of Hamiltonian Monte Carlo
+ *
+ * Velocities have distribution N(0, M), kinetic energy 0.5 * v^T M^{-1} v,
+ * and the position moves with velocity M^{-1} v. The metric is specified by
+ * its inverse, which should approximate the covariance of the target.
+ */
+#ifndef METRIC_H
+#define METRIC_H
+
+#include "rng.h"
+#include <armadillo>
+#include <iostream>
+
+class Metric
+{
+public:
+    // Types of metric: the identity, diagonal, dense
+    enum Type { UNIT = 0, DIAG = 1, DENSE = 2 };
+    
+    /* Constructor (the identity)
+     *
+     * dimension : Dimension of the state
+     */
+    Metric(const int dimension = 1);
+    
+    // Set to the identity
+    void set_unit();
+    
+    // Set diagonal, with inverse diag(inv_metric)
+    void set_diag(const arma::vec &inv_metric);
+    
+    // Set dense, with inverse inv_metric (symmetric positive definite)
+    void set_dense(const arma::mat &inv_metric);
+    
+    // Get type of metric
+    Type get_type();
+    
+    // Get dimension
+    int get_dimension();
+    
+    // Get the inverse metric, as a dense matrix
+    void get_inv_metric(arma::mat &inv_metric);
+    
+    // Draw velocity v from N(0, M)
+    void sample_velocity(Rng &generator,
+                         arma::vec &v);
+    
+    // Kinetic energy of velocity v
+    double kinetic(const arma::vec &v);
+    
+    // Set out = M^{-1} v
+    void apply_inv(const arma::vec &v,
+                   arma::vec &out);
+    
+    // Full step for position: x += epsilon * M^{-1} v
+    void update_position(arma::vec &x,
+                         const arma::vec &v,
+                         const double epsilon);
+    
+    // Write the metric to a binary stream
+    void save(std::ostream &out);
+    
+    // Restore a metric written by save
+    void load(std::istream &in);
+    
+private:
+    // Type of metric
+    Type m_type;
+    
+    // Dimension
+    int m_dimension;
+    
+    // Diagonal of the inverse metric (DIAG), and its square root
+    arma::vec m_inv_diag, m_inv_diag_sqrt;
+    
+    // Inverse metric (DENSE), and its upper triangular Cholesky factor U
+    // (so that the inverse metric is U^T U)
+    arma::mat m_inv_dense, m_inv_chol;
+    
+    // Workspace
+    arma::vec m_work;
+};
+
+#endif
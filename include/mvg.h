@@ -1,9 +1,13 @@
 /* Functions to compute the log-density and simulate from,
  * a multivariate Gaussian distribution
+ *
+ * Class MVG, at the end of the file, precomputes what the functions need
+ * once, for repeated evaluation.
  */
 #ifndef MVG_H
 #define MVG_H
 
+#include "rng.h"
 #include <armadillo>
 #include <random>
 
@@ -103,6 +107,42 @@ double mvg_lap_ld(const arma::vec &state,
 double mvg_lap_ld(const arma::vec &state,
                   const arma::mat &mu_L);
 
+/* Log-density of a multivariate Gaussian at many states
+ *
+ * states   : States at which to evaluate the log-density, one per column
+ * log_dens : The log-density at each state
+ * mu_L     : Mean and the lower triangular Cholesky decomposition
+ *            of the covariance matrix, horizontally concatenated so
+ *            that the first column is mu
+ */
+void mvg_ld_batch(const arma::mat &states,
+                  arma::vec &log_dens,
+                  const arma::mat &mu_L);
+
+/* Log-density of an unnormalized multivariate Gaussian at many states
+ *
+ * states   : States at which to evaluate the log-density, one per column
+ * log_dens : The log-density at each state
+ * mu_L     : Mean and the lower triangular Cholesky decomposition
+ *            of the covariance matrix, horizontally concatenated so
+ *            that the first column is mu
+ */
+void mvg_ld_un_batch(const arma::mat &states,
+                     arma::vec &log_dens,
+                     const arma::mat &mu_L);
+
+/* Gradient of the log-density of a multivariate Gaussian at many states
+ *
+ * states : States at which to evaluate the gradient, one per column
+ * grads  : The gradient at each state, one per column
+ * mu_L   : Mean and the lower triangular Cholesky decomposition
+ *          of the covariance matrix, horizontally concatenated so
+ *          that the first column is mu
+ */
+void mvg_grad_ld_batch(const arma::mat &states,
+                       arma::mat &grads,
+                       const arma::mat &mu_L);
+
 /* Simulate from a multivariate Gaussian distribution
  *
  * Note: does not check that state, mu and L have corresponding dimensions
@@ -132,4 +172,108 @@ int rmvg(std::mt19937_64 &generator,
          arma::vec &state,
          const arma::mat &mu_L);
 
+/* Simulate from a multivariate Gaussian distribution
+ *
+ * As above, drawing the Gaussian random numbers in bulk
+ *
+ * generator : random number generator
+ * state     : State at which to evaluate the log-density
+ * mu        : Mean
+ * L         : Lower triangular matrix, the Cholesky decomposition of
+ *             the covariance matrix
+ */
+void rmvg(Rng &generator,
+          arma::vec &state,
+          const arma::vec &mu,
+          const arma::mat &L);
+
+/* Class representing a multivariate Gaussian distribution
+ *
+ * Precomputes the lower triangular Cholesky factor L of the covariance
+ * matrix, the log normalizing constant and the trace of the precision
+ * matrix, so that evaluations take O(d^2) operations (triangular solves
+ * with L). Member functions are const, so that a MVG object can be used
+ * as the target of a LogPost object and shared between threads.
+ */
+class MVG
+{
+public:
+    /* Constructor
+     *
+     * mu    : Mean
+     * Sigma : Covariance matrix (symmetric positive definite)
+     */
+    MVG(const arma::vec &mu,
+        const arma::mat &Sigma);
+    
+    /* Constructor
+     *
+     * mu_L : Mean and the lower triangular Cholesky decomposition
+     *        of the covariance matrix, horizontally concatenated so
+     *        that the first column is mu
+     */
+    MVG(const arma::mat &mu_L);
+    
+    // Get the dimension
+    int get_dimension() const;
+    
+    // Get the mean
+    const arma::vec& get_mean() const;
+    
+    // Get the lower triangular Cholesky factor of the covariance matrix
+    const arma::mat& get_chol() const;
+    
+    // Log-density at state
+    double log_dens(const arma::vec &state) const;
+    
+    // Log-density at state, without the normalizing constant
+    double log_dens_un(const arma::vec &state) const;
+    
+    // Gradient of the log-density at state, stored in grad
+    void grad_log_dens(const arma::vec &state,
+                       arma::vec &grad) const;
+    
+    // Log-density at state, also storing the gradient in grad
+    double log_dens_and_grad(const arma::vec &state,
+                             arma::vec &grad) const;
+    
+    // Log-density at each column of states, stored in log_dens
+    void batch_log_dens(const arma::mat &states,
+                        arma::vec &log_dens) const;
+    
+    // Gradient of the log-density at each column of states, stored in the
+    // columns of grads
+    void batch_grad_log_dens(const arma::mat &states,
+                             arma::mat &grads) const;
+    
+    // Laplacian of the log-density (the same at every state)
+    double laplacian_log_dens() const;
+    
+    // Simulate state from the distribution
+    void sample(Rng &generator,
+                arma::vec &state) const;
+    
+    // Simulate n states from the distribution, stored in the columns of
+    // states
+    void sample(Rng &generator,
+                arma::mat &states,
+                const int n) const;
+    
+private:
+    // Dimension
+    int m_dimension;
+    
+    // Mean
+    arma::vec m_mu;
+    
+    // Lower triangular Cholesky factor of the covariance matrix
+    arma::mat m_L;
+    
+    // Log normalizing constant, trace of the precision matrix
+    double m_logZ, m_trace_precision;
+    
+    // Compute m_logZ and m_trace_precision from m_L
+    void precompute();
+};
+
 #endif
@@ -0,0 +1,178 @@
+/* Class representing a Markov chain generated using the No-U-Turn Sampler
+ * (Hoffman and Gelman, 2014), with multinomial sampling from each
+ * trajectory (Betancourt, 2017)
+ */
+#ifndef NUTS_H
+#define NUTS_H
+
+#include "dual_avg.h"
+#include "log_post.h"
+#include "mcmc.h"
+#include "metric.h"
+#include "point.h"
+#include <armadillo>
+#include <vector>
+
+class NUTS : public MCMC
+{
+public:
+    /* Default Constructor
+     *
+     * burn      : The burn-in period
+     * thin      : Thinning interval
+     * n_samples : Number of (thinned) samples to generate
+     * epsilon   : Step-size for the Leapfrog integrator
+     * max_depth : Maximum depth of the trajectory's binary tree, so that
+     *             trajectories have at most 2^max_depth leapfrog steps
+     */
+    NUTS(const int burn = 10000,
+         const int thin = 1,
+         const int n_samples = 10000,
+         const double epsilon = 0.1,
+         const int max_depth = 10);
+    
+    /* Constructor
+     *
+     * log_post      : The log posterior
+     * initial_state : The initial state
+     * burn          : The burn-in period
+     * thin          : Thinning interval
+     * n_samples     : Number of (thinned) samples to generate
+     * epsilon       : Step-size for the Leapfrog integrator
+     * max_depth     : Maximum depth of the trajectory's binary tree
+     */
+    NUTS(LogPost log_post,
+         const arma::vec &initial_state,
+         const int burn,
+         const int thin,
+         const int n_samples,
+         const double epsilon = 0.1,
+         const int max_depth = 10);
+    
+    // Set leapfrog step size (epsilon)
+    void set_step_size(double epsilon);
+    
+    // Set maximum tree depth
+    void set_max_depth(int max_depth);
+    
+    // Return leapfrog step size (epsilon)
+    double get_step_size();
+    
+    // Return maximum tree depth
+    int get_max_depth();
+    
+    /* Adapt the leapfrog step-size
+     *
+     * Adapts epsilon by dual averaging during the burn-in period of the next
+     * call to nuts(), so that the average acceptance statistic of
+     * trajectories approaches target_accept. After burn-in epsilon is fixed.
+     *
+     * target_accept : Target average acceptance statistic
+     */
+    void adapt_step_size(const double target_accept = 0.8);
+    
+    // Set the metric
+    void set_metric(Metric metric);
+    
+    // Return the metric
+    Metric get_metric();
+    
+    // Return the depth of the latest trajectory's tree
+    int get_tree_depth();
+    
+    // Return the average tree depth after burn-in
+    double get_mean_tree_depth();
+    
+    // Return the number of divergent trajectories after burn-in
+    int get_n_divergent();
+    
+    // Return the total number of leapfrog steps taken
+    long long get_n_leapfrog();
+    
+    // Generate a Markov chain using the No-U-Turn Sampler
+    void nuts();
+    
+private:
+    // Leapfrog step-size, acceptance statistic of the latest trajectory,
+    // error in the Hamiltonian beyond which a trajectory is divergent
+    double m_epsilon, m_accept_stat, m_max_delta_H;
+    
+    // Maximum tree depth, tree depth of the latest trajectory,
+    // indicator of whether the latest trajectory diverged,
+    // indicator of whether to adapt the step-size during burn-in,
+    // number of iterations after burn-in, and divergences among them
+    int m_max_depth, m_tree_depth, m_divergent, m_adapt_step_size,
+        m_n_iter, m_n_divergent;
+    
+    // Sum of tree depths after burn-in, number of leapfrog steps
+    long long m_sum_tree_depth, m_n_leapfrog;
+    
+    // Sum of acceptance statistics and number of steps in the latest
+    // trajectory
+    double m_sum_accept_stat;
+    int m_n_steps;
+    
+    // Step-size adaptation
+    DualAveraging m_dual_avg;
+    
+    // Metric
+    Metric m_metric;
+    
+    // Current state, state sampled from the trajectory, ends of the
+    // trajectory
+    Point m_point_current, m_point_sample, m_point_fwd, m_point_bwd;
+    
+    // Initial velocity, velocities at the ends of the trajectory, sum of
+    // velocities over the trajectory, M^{-1} times the velocities at the ends
+    arma::vec m_velocity, m_velocity_fwd, m_velocity_bwd, m_rho,
+              m_p_sharp_fwd, m_p_sharp_bwd;
+    
+    /* Buffers for building trees, allocated once. Entry j describes the
+     * latest subtree of depth j: log of the sum of weights of its states,
+     * the state sampled from it, the sum of its velocities and M^{-1} times
+     * the velocities at its first and last states.
+     */
+    std::vector<double> m_tree_log_sum_weight;
+    std::vector<Point> m_tree_sample;
+    std::vector<arma::vec> m_tree_rho, m_tree_p_sharp_begin, m_tree_p_sharp_end;
+    
+    // Allocate the tree-building buffers
+    void allocate_trees();
+    
+    // Markov kernel used by MCMC::run
+    int kern() override;
+    
+    // Markov kernel used by MCMC::run during burn-in, adapting the step-size
+    int burn_kern() override;
+    
+    // Fix the adapted step-size
+    void end_burn() override;
+    
+    // Write / restore the step-size, metric, step-size adaptation and
+    // trajectory statistics
+    void save_state(std::ostream &out) override;
+    void load_state(std::istream &in) override;
+    
+    // No-U-Turn Sampler Kernel
+    // Returns an indicator of whether the chain moved
+    int nuts_kern();
+    
+    /* Extend the trajectory by a subtree of 2^depth leapfrog steps
+     *
+     * Results are stored in entry depth of the tree buffers.
+     * Returns 0 if the subtree diverged or made a U-turn, 1 otherwise.
+     *
+     * depth : Depth of the subtree
+     * z     : End of the trajectory to extend (updated)
+     * v     : Velocity at z (updated)
+     * sign  : 1 to integrate forwards in time, -1 backwards
+     * H0    : Hamiltonian at the initial state
+     */
+    int build_tree(const int depth,
+                   Point &z,
+                   arma::vec &v,
+                   const double sign,
+                   const double H0);
+};
+
+#endif
@@ -0,0 +1,24 @@
+/* A state of a Markov chain together with the log-density of the
+ * posterior, and its gradient, evaluated at that state
+ *
+ * Caching these alongside the state means they needn't be recomputed
+ * for as long as the chain remains at the state.
+ */
+#ifndef POINT_H
+#define POINT_H
+
+#include <armadillo>
+
+struct Point
+{
+    // State
+    arma::vec x;
+    
+    // Log-density of the posterior at x
+    double log_dens;
+    
+    // Gradient of the log-density of the posterior at x
+    arma::vec grad;
+};
+
+#endif
@@ -26,3 +26,17 @@ void print_vector_vec(std::vector<arma::vec> &v);
  */
 void print_vector_vec(std::vector<arma::vec> &v,
                       std::ofstream &file);
+
+/* Print the columns of an arma::mat to the console, one column per line
+ *
+ * m    : Matrix whose columns to print
+ */
+void print_columns(const arma::mat &m);
+
+/* Print the columns of an arma::mat to a file, one column per line
+ *
+ * m    : Matrix whose columns to print
+ * file : File to print to
+ */
+void print_columns(const arma::mat &m,
+                   std::ofstream &file);
@@ -0,0 +1,123 @@
+/* Class representing a source of random numbers for the samplers
+ *
+ * Either the counter-based Philox generator (Salmon et al., 2011) or a
+ * Mersenne Twister (std::mt19937_64). Satisfies the requirements of a
+ * uniform random bit generator, so can be used with the distributions of
+ * <random>, and also fills whole vectors and matrices with Gaussian random
+ * numbers at once, which is much faster than drawing them one at a time.
+ *
+ * Philox output is a function of a key (the seed) and a 128-bit counter
+ * made of the stream (32 bits), the iteration (64 bits) and a position
+ * within the iteration (32 bits, i.e. up to 2^32 blocks of 128 random
+ * bits per iteration), so the random numbers of any iteration of any
+ * stream can be generated directly, without generating those before them.
+ */
+#ifndef RNG_H
+#define RNG_H
+
+#include <armadillo>
+#include <cstdint>
+#include <iostream>
+#include <random>
+
+class Rng
+{
+public:
+    // Types of generator
+    enum Type { MT19937 = 0, PHILOX = 1 };
+    
+    typedef std::uint64_t result_type;
+    
+    /* Constructor
+     *
+     * type : Type of generator
+     */
+    Rng(const Type type = PHILOX);
+    
+    // Set the type of generator, reseeding it with the latest seed
+    void set_type(const Type type);
+    
+    // Get the type of generator
+    Type get_type();
+    
+    // Seed the generator
+    void seed(const unsigned int s);
+    
+    /* Seed the generator with a seed and stream
+     *
+     * Generators sharing a seed but given different streams produce
+     * independent sequences.
+     *
+     * s      : Seed
+     * stream : Stream (e.g. the index of a chain)
+     */
+    void seed(const unsigned long long s,
+              const unsigned int stream);
+    
+    /* Start iteration
+     *
+     * Subsequent random numbers (until the next call) depend only on the
+     * seed, stream and iteration. Has no effect on a Mersenne Twister.
+     *
+     * iteration : Index of the iteration
+     */
+    void set_iteration(const unsigned long long iteration);
+    
+    // Get the iteration
+    unsigned long long get_iteration();
+    
+    // Smallest and largest values returned by operator()
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~(result_type)0; }
+    
+    // Return 64 random bits
+    result_type operator()();
+    
+    // Return a uniform random number in (0, 1)
+    double uniform();
+    
+    // Fill the n values starting at x with standard Gaussian random numbers
+    void fill_normal(double *x,
+                     const int n);
+    
+    // Fill a vector or matrix with standard Gaussian random numbers
+    void fill_normal(arma::mat &x);
+    
+    // Write the complete state of the generator to a binary stream
+    void save(std::ostream &out);
+    
+    // Restore a state written by save
+    void load(std::istream &in);
+    
+    // Return 1 if Philox4x32-10 reproduces the known-answer vectors of
+    // Salmon et al. (2011), 0 otherwise
+    static int check_philox();
+    
+private:
+    // Type of generator
+    Type m_type;
+    
+    // Latest seed and stream, indicator of whether a stream was given
+    unsigned long long m_seed;
+    unsigned int m_stream;
+    int m_seeded_with_stream;
+    
+    // Mersenne Twister, and the Gaussian distribution used with it
+    std::mt19937_64 m_mt;
+    std::normal_distribution<double> m_rnorm;
+    
+    // Philox key, iteration, index of the next block of random bits within
+    // the iteration
+    std::uint32_t m_key[2];
+    std::uint64_t m_iteration, m_counter;
+    
+    // Random bits from the latest Philox block not yet returned
+    std::uint64_t m_buffer[2];
+    int m_n_buffered;
+    
+    // Philox4x32-10: compute the 128 random bits of block counter
+    void philox(const std::uint64_t counter,
+                std::uint64_t out[2]);
+};
+
+#endif
@@ -59,13 +59,23 @@ public:
     // Estimate the Expectation of a scalar function using RWM
     double est_expec_fcn(double (*fcn)(const arma::vec &state));
     
-private:
+protected:
+    // Markov kernel used by MCMC::run
+    int kern() override;
+    
+    // Write / restore the proposal standard deviation
+    void save_state(std::ostream &out) override;
+    void load_state(std::istream &in) override;
+    
     // Updates m_current according to a Random Walk Metropolis
     // symmetric kernel
-    int rwm_sym_kern();
+    virtual int rwm_sym_kern();
     
     // Standard deviation of the Gaussian proposal
     double m_prop_sd;
+    
+    // Log density of the posterior at m_current (valid when m_current_cached)
+    double m_current_log_dens;
 };
 
 #endif
@@ -0,0 +1,98 @@
+/* Class representing a Markov chain generated using Stochastic Gradient
+ * Hamiltonian Monte Carlo (Chen, Fox and Guestrin, 2014)
+ */
+#ifndef SGHMC_H
+#define SGHMC_H
+
+#include "log_post.h"
+#include "mcmc.h"
+#include <armadillo>
+
+class SGHMC : public MCMC
+{
+public:
+    /* Default Constructor
+     *
+     * burn       : The burn-in period
+     * thin       : Thinning interval
+     * n_samples  : Number of (thinned) samples to generate
+     * epsilon    : Step-size
+     * friction   : Friction (C), damping the velocity
+     * batch_size : Number of rows of data used to estimate each gradient
+     */
+    SGHMC(const int burn = 10000,
+          const int thin = 1,
+          const int n_samples = 10000,
+          const double epsilon = 1e-3,
+          const double friction = 1.0,
+          const int batch_size = 100);
+    
+    /* Constructor
+     *
+     * The log posterior must be a sum over rows of data with a gradient
+     * (see LogPost::set_sum_log_lik). Control variates set on it with
+     * LogPost::set_control_variate are used in the gradient estimates.
+     *
+     * log_post      : The log posterior
+     * initial_state : The initial state
+     * burn          : The burn-in period
+     * thin          : Thinning interval
+     * n_samples     : Number of (thinned) samples to generate
+     * epsilon       : Step-size
+     * friction      : Friction (C), damping the velocity
+     * batch_size    : Number of rows of data used to estimate each gradient
+     */
+    SGHMC(LogPost log_post,
+          const arma::vec &initial_state,
+          const int burn,
+          const int thin,
+          const int n_samples,
+          const double epsilon = 1e-3,
+          const double friction = 1.0,
+          const int batch_size = 100);
+    
+    // Set step size (epsilon)
+    void set_step_size(double epsilon);
+    
+    // Set friction (C)
+    void set_friction(double friction);
+    
+    // Set number of rows of data used to estimate each gradient
+    void set_batch_size(int batch_size);
+    
+    // Return step size (epsilon)
+    double get_step_size();
+    
+    // Return friction (C)
+    double get_friction();
+    
+    // Return number of rows of data used to estimate each gradient
+    int get_batch_size();
+    
+    // Generate a chain using Stochastic Gradient Hamiltonian Monte Carlo
+    void sghmc();
+    
+private:
+    // Step-size, friction
+    double m_epsilon, m_friction;
+    
+    // Number of rows of data used to estimate each gradient
+    int m_batch_size;
+    
+    // Velocity (kept between iterations), gradient estimate, Gaussian noise
+    arma::vec m_velocity, m_grad, m_noise;
+    
+    // Markov kernel used by MCMC::run
+    int kern() override;
+    
+    // Write / restore the velocity
+    void save_state(std::ostream &out) override;
+    void load_state(std::istream &in) override;
+    
+    // Stochastic Gradient Hamiltonian Monte Carlo kernel: one step of the
+    // dynamics with friction, without a Metropolis correction.
+    // Returns 1 (every move is taken).
+    int sghmc_kern();
+};
+
+#endif
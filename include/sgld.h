@@ -0,0 +1,83 @@
+/* Class representing a Markov chain generated using Stochastic Gradient
+ * Langevin Dynamics (Welling and Teh, 2011)
+ */
+#ifndef SGLD_H
+#define SGLD_H
+
+#include "log_post.h"
+#include "mcmc.h"
+#include <armadillo>
+
+class SGLD : public MCMC
+{
+public:
+    /* Default Constructor
+     *
+     * burn       : The burn-in period
+     * thin       : Thinning interval
+     * n_samples  : Number of (thinned) samples to generate
+     * epsilon    : Step-size
+     * batch_size : Number of rows of data used to estimate each gradient
+     */
+    SGLD(const int burn = 10000,
+         const int thin = 1,
+         const int n_samples = 10000,
+         const double epsilon = 1e-4,
+         const int batch_size = 100);
+    
+    /* Constructor
+     *
+     * The log posterior must be a sum over rows of data with a gradient
+     * (see LogPost::set_sum_log_lik). Control variates set on it with
+     * LogPost::set_control_variate are used in the gradient estimates.
+     *
+     * log_post      : The log posterior
+     * initial_state : The initial state
+     * burn          : The burn-in period
+     * thin          : Thinning interval
+     * n_samples     : Number of (thinned) samples to generate
+     * epsilon       : Step-size
+     * batch_size    : Number of rows of data used to estimate each gradient
+     */
+    SGLD(LogPost log_post,
+         const arma::vec &initial_state,
+         const int burn,
+         const int thin,
+         const int n_samples,
+         const double epsilon = 1e-4,
+         const int batch_size = 100);
+    
+    // Set step size (epsilon)
+    void set_step_size(double epsilon);
+    
+    // Set number of rows of data used to estimate each gradient
+    void set_batch_size(int batch_size);
+    
+    // Return step size (epsilon)
+    double get_step_size();
+    
+    // Return number of rows of data used to estimate each gradient
+    int get_batch_size();
+    
+    // Generate a chain using Stochastic Gradient Langevin Dynamics
+    void sgld();
+    
+private:
+    // Step-size
+    double m_epsilon;
+    
+    // Number of rows of data used to estimate each gradient
+    int m_batch_size;
+    
+    // Gradient estimate, Gaussian noise
+    arma::vec m_grad, m_noise;
+    
+    // Markov kernel used by MCMC::run
+    int kern() override;
+    
+    // Stochastic Gradient Langevin Dynamics kernel, without a Metropolis
+    // correction. Returns 1 (every move is taken).
+    int sgld_kern();
+};
+
+#endif
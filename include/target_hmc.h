@@ -0,0 +1,158 @@
+/* Class representing a Markov chain generated using Hamiltonian Monte
+ * Carlo, calling the log density and gradient of a target class directly
+ */
+#ifndef TARGET_HMC_H
+#define TARGET_HMC_H
+
+#include "hmc.h"
+#include "log_post.h"
+#include "metric.h"
+#include "point.h"
+#include <armadillo>
+#include <memory>
+#include <utility>
+
+/* Target is a class with member functions
+ *     double log_dens(const arma::vec& state) const
+ *     void grad_log_dens(const arma::vec& state, arma::vec& grad) const
+ * and, optionally,
+ *     double log_dens_and_grad(const arma::vec& state,
+ *                              arma::vec& grad) const
+ * (see LogPost). The kernel, including the leapfrog integrator, calls them
+ * directly rather than through LogPost, so for small models they can be
+ * inlined into the kernel. Used like HMC (including adaptation of the
+ * step-size and metric), except that evaluations of the target aren't
+ * counted by the posterior and LogPost::transform doesn't apply to them.
+ */
+template <class Target>
+class TargetHMC : public HMC
+{
+    static_assert(has_log_dens<Target>::value &&
+                  has_grad_log_dens<Target>::value,
+                  "Target must have member functions log_dens and "
+                  "grad_log_dens");
+    
+public:
+    /* Constructor
+     *
+     * target        : The target density, shared with copies of the chain
+     * initial_state : The initial state
+     * burn          : The burn-in period
+     * thin          : Thinning interval
+     * n_samples     : Number of (thinned) samples to generate
+     * epsilon       : Step-size for the Leapfrog integrator
+     * L             : Number of leapfrog steps.
+     */
+    TargetHMC(Target target,
+              const arma::vec &initial_state,
+              const int burn,
+              const int thin,
+              const int n_samples,
+              const double epsilon = 0.01,
+              const int L = 100);
+    
+private:
+    // Constructor, sharing target with the posterior
+    TargetHMC(std::shared_ptr<const Target> target,
+              const arma::vec &initial_state,
+              const int burn,
+              const int thin,
+              const int n_samples,
+              const double epsilon,
+              const int L);
+    
+    // The target density
+    std::shared_ptr<const Target> m_target;
+    
+    // As HMC::hmc_kern, calling the target directly
+    int hmc_kern() override;
+    
+    // Log density at state, also storing its gradient in grad
+    double log_dens_and_grad(const arma::vec &state,
+                             arma::vec &grad);
+};
+
+template <class Target>
+TargetHMC<Target>::TargetHMC(Target target,
+                             const arma::vec &initial_state,
+                             const int burn,
+                             const int thin,
+                             const int n_samples,
+                             const double epsilon,
+                             const int L)
+    : TargetHMC(std::make_shared<const Target>(std::move(target)),
+                initial_state, burn, thin, n_samples, epsilon, L)
+{
+}
+
+template <class Target>
+TargetHMC<Target>::TargetHMC(std::shared_ptr<const Target> target,
+                             const arma::vec &initial_state,
+                             const int burn,
+                             const int thin,
+                             const int n_samples,
+                             const double epsilon,
+                             const int L)
+    : HMC(LogPost(initial_state.n_elem, target), initial_state, burn, thin,
+          n_samples, epsilon, L),
+    m_target{ target }
+{
+}
+
+template <class Target>
+int TargetHMC<Target>::hmc_kern()
+{
+    // A chain given an initial state of another dimension since it was
+    // constructed starts with the identity metric
+    if (m_metric.get_dimension() != m_dimension){
+        m_metric = Metric(m_dimension);
+    }
+    
+    // Evaluate the log-density and gradient at the current state, unless
+    // they are still cached from a previous application of the kernel
+    if (!m_current_cached)
+    {
+        m_point_current.x = m_current;
+        m_point_current.log_dens = log_dens_and_grad(m_current,
+                                                     m_point_current.grad);
+        m_current_cached = 1;
+    }
+    m_point_prop = m_point_current;
+    
+    // Gibbs update of the velocity
+    m_metric.sample_velocity(m_gen, m_velocity_current);
+    m_velocity_prop = m_velocity_current;
+    
+    // Leapfrog integration, as by leapfrog_transform
+    Point &z = m_point_prop;
+    arma::vec &v = m_velocity_prop;
+    v += 0.5 * m_epsilon * z.grad;
+    for (int i = 0; i < m_L; ++i)
+    {
+        m_metric.update_position(z.x, v, m_epsilon);
+        if (i < (m_L-1))
+        {
+            m_target->grad_log_dens(z.x, z.grad);
+            v += m_epsilon * z.grad;
+        } else {
+            z.log_dens = log_dens_and_grad(z.x, z.grad);
+        }
+    }
+    v += 0.5 * m_epsilon * z.grad;
+    
+    return accept_proposal();
+}
+
+template <class Target>
+double TargetHMC<Target>::log_dens_and_grad(const arma::vec &state,
+                                            arma::vec &grad)
+{
+    if constexpr (has_log_dens_and_grad<Target>::value){
+        return m_target->log_dens_and_grad(state, grad);
+    } else {
+        m_target->grad_log_dens(state, grad);
+        return m_target->log_dens(state);
+    }
+}
+
+#endif
@@ -0,0 +1,113 @@
+/* Class representing a Markov chain generated using the Random Walk
+ * Metropolis algorithm, calling the log density of a target class directly
+ */
+#ifndef TARGET_RWM_H
+#define TARGET_RWM_H
+
+#include "log_post.h"
+#include "rwm.h"
+#include <armadillo>
+#include <cmath>
+#include <memory>
+#include <utility>
+
+/* Target is a class with member function
+ *     double log_dens(const arma::vec& state) const
+ * (see LogPost). The kernel calls it directly, rather than through LogPost,
+ * so for small models it can be inlined into the kernel. Used like RWM,
+ * except that evaluations of the target aren't counted by the posterior
+ * and LogPost::transform doesn't apply to them.
+ */
+template <class Target>
+class TargetRWM : public RWM
+{
+    static_assert(has_log_dens<Target>::value,
+                  "Target must have member function log_dens");
+    
+public:
+    /* Constructor
+     *
+     * target        : The target density, shared with copies of the chain
+     * initial_state : Initial state of the Markov chain
+     * burn          : Burn-in period
+     * thin          : Thinning interval
+     * n_samples     : Number of (thinned) samples to generate
+     * prop_sd       : Standard deviation of the proposal
+     */
+    TargetRWM(Target target,
+              const arma::vec &initial_state,
+              const int burn = 10000,
+              const int thin = 1,
+              const int n_samples = 10000,
+              const double prop_sd = 1.0);
+    
+private:
+    // Constructor, sharing target with the posterior
+    TargetRWM(std::shared_ptr<const Target> target,
+              const arma::vec &initial_state,
+              const int burn,
+              const int thin,
+              const int n_samples,
+              const double prop_sd);
+    
+    // The target density
+    std::shared_ptr<const Target> m_target;
+    
+    // As RWM::rwm_sym_kern, calling the target directly
+    int rwm_sym_kern() override;
+};
+
+template <class Target>
+TargetRWM<Target>::TargetRWM(Target target,
+                             const arma::vec &initial_state,
+                             const int burn,
+                             const int thin,
+                             const int n_samples,
+                             const double prop_sd)
+    : TargetRWM(std::make_shared<const Target>(std::move(target)),
+                initial_state, burn, thin, n_samples, prop_sd)
+{
+}
+
+template <class Target>
+TargetRWM<Target>::TargetRWM(std::shared_ptr<const Target> target,
+                             const arma::vec &initial_state,
+                             const int burn,
+                             const int thin,
+                             const int n_samples,
+                             const double prop_sd)
+    : RWM(LogPost(initial_state.n_elem, target), initial_state, burn, thin,
+          n_samples, prop_sd),
+    m_target{ target }
+{
+}
+
+template <class Target>
+int TargetRWM<Target>::rwm_sym_kern()
+{
+    m_gen.fill_normal(m_prop);
+    m_prop *= m_prop_sd;
+    m_prop += m_current;
+    
+    // The log density at the current state only changes on acceptance
+    if (!m_current_cached)
+    {
+        m_current_log_dens = m_target->log_dens(m_current);
+        m_current_cached = 1;
+    }
+    
+    int accept = 0;
+    double prop_log_dens = m_target->log_dens(m_prop);
+    double log_accept_prob = prop_log_dens - m_current_log_dens;
+    double u = m_gen.uniform();
+    
+    if (log(u) < log_accept_prob)
+    {
+        m_current = m_prop;
+        m_current_log_dens = prop_log_dens;
+        accept = 1;
+    }
+    return accept;
+}
+
+#endif
@@ -0,0 +1,82 @@
+/* A persistent pool of worker threads
+ */
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    /* Constructor
+     *
+     * n_threads : Number of threads used, including the calling thread.
+     *             If not positive, uses the number of hardware threads.
+     */
+    ThreadPool(int n_threads = 0);
+    
+    // Destructor: stops and joins the worker threads
+    ~ThreadPool();
+    
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    
+    // Return the number of threads used, including the calling thread
+    int get_n_threads();
+    
+    /* Call task(i) for i = 0, 1, ..., n_tasks-1, distributing the calls
+     * over the threads of the pool, and return once every call has finished
+     *
+     * Which thread runs task(i) is unspecified, so results should be
+     * written to locations depending on i only. Calls from several threads
+     * at once run one after another. Must not be called from within a task
+     * running on the same pool. If a task throws, the remaining tasks
+     * still run, and the first exception caught is rethrown once they have
+     * finished.
+     *
+     * n_tasks : Number of tasks
+     * task    : Function to call with the index of each task
+     */
+    void parallel_for(int n_tasks,
+                      const std::function<void(int)> &task);
+    
+private:
+    // Worker threads
+    std::vector<std::thread> m_workers;
+    
+    // Held for the duration of each call to parallel_for
+    std::mutex m_call_mutex;
+    
+    // Guards the members below
+    std::mutex m_mutex;
+    
+    // Signal new work (or stopping) to the workers, and completion of the
+    // work to the calling thread
+    std::condition_variable m_work_cv, m_done_cv;
+    
+    // Task currently being distributed
+    const std::function<void(int)> *m_task;
+    
+    // Number of tasks, index of the next task to hand out,
+    // number of tasks not yet finished, indicator of whether to stop
+    int m_n_tasks, m_next_task, m_n_unfinished, m_stop;
+    
+    // First exception thrown by a task of the current call
+    std::exception_ptr m_exception;
+    
+    // Incremented each time parallel_for hands out new work
+    unsigned long m_generation;
+    
+    // Run tasks until none are left to hand out. Expects lock to be held.
+    void run_tasks(std::unique_lock<std::mutex> &lock);
+    
+    // Main loop of a worker thread
+    void worker();
+};
+
+#endif
@@ -0,0 +1,46 @@
+/* Check the Philox generator of class Rng
+ *
+ * Checks Philox4x32-10 against the known-answer vectors of Salmon et al.
+ * (2011), and that the counter layout gives iterations 2^32 apart, and
+ * different streams, their own random numbers while reproducing those of
+ * a repeated iteration. Returns 0 on success, 1 otherwise.
+ */
+#include "rng.h"
+#include <iostream>
+
+int main()
+{
+    int ok = 1;
+    if (!Rng::check_philox()){
+        std::cout << "Philox4x32-10 doesn't match the known answers\n";
+        ok = 0;
+    }
+    
+    Rng gen;
+    gen.seed(12345ULL, 3);
+    gen.set_iteration(5);
+    Rng::result_type first = gen();
+    gen.set_iteration(5ULL + (1ULL << 32));
+    Rng::result_type far = gen();
+    gen.set_iteration(5);
+    Rng::result_type again = gen();
+    gen.seed(12345ULL, 4);
+    gen.set_iteration(5);
+    Rng::result_type other_stream = gen();
+    
+    if (far == first){
+        std::cout << "Iterations 2^32 apart give the same random numbers\n";
+        ok = 0;
+    }
+    if (again != first){
+        std::cout << "A repeated iteration gives different random numbers\n";
+        ok = 0;
+    }
+    if (other_stream == first){
+        std::cout << "Different streams give the same random numbers\n";
+        ok = 0;
+    }
+    
+    if (ok) std::cout << "Rng checks passed\n";
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+/* Class accumulating estimates of moments from a stream of samples
+ */
+#include "accumulator.h"
+#include "checkpoint.h"
+#include <armadillo>
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+Accumulator::Accumulator(const int dimension,
+                         const int track_cov)
+    : m_dimension{ dimension },
+    m_track_cov{ track_cov },
+    m_n{ 0 }
+{
+    assert(dimension > 0);
+    m_mean.zeros(m_dimension);
+    m_m2.zeros(m_dimension);
+    m_delta.zeros(m_dimension);
+    if (m_track_cov) m_comoment.zeros(m_dimension, m_dimension);
+}
+
+int Accumulator::add_fcn(double (*fcn)(const arma::vec &state))
+{
+    assert(m_n == 0);
+    m_fcns.push_back(fcn);
+    m_fcn_means.push_back(0.0);
+    return m_fcns.size() - 1;
+}
+
+void Accumulator::add(const arma::vec &x)
+{
+    assert((int)x.n_elem == m_dimension);
+    ++m_n;
+    double w = 1.0 / m_n;
+    
+    // Welford's update: the deviation from the previous mean multiplies the
+    // deviation from the updated mean
+    m_delta = x - m_mean;
+    m_mean += w * m_delta;
+    for (int i = 0; i < m_dimension; ++i)
+    {
+        m_m2[i] += m_delta[i] * (x[i] - m_mean[i]);
+    }
+    if (m_track_cov){
+        for (int j = 0; j < m_dimension; ++j)
+        {
+            m_comoment.col(j) += (x[j] - m_mean[j]) * m_delta;
+        }
+    }
+    
+    for (std::size_t k = 0; k < m_fcns.size(); ++k)
+    {
+        m_fcn_means[k] += w * (m_fcns[k](x) - m_fcn_means[k]);
+    }
+}
+
+void Accumulator::reset()
+{
+    m_n = 0;
+    m_mean.zeros();
+    m_m2.zeros();
+    if (m_track_cov) m_comoment.zeros();
+    for (std::size_t k = 0; k < m_fcn_means.size(); ++k) m_fcn_means[k] = 0.0;
+}
+
+int Accumulator::get_dimension()
+{
+    return m_dimension;
+}
+
+long long Accumulator::get_n()
+{
+    return m_n;
+}
+
+void Accumulator::get_mean(arma::vec &mean)
+{
+    mean = m_mean;
+}
+
+void Accumulator::get_var(arma::vec &var)
+{
+    assert(m_n > 1);
+    var = m_m2 / (m_n - 1);
+}
+
+void Accumulator::get_cov(arma::mat &cov)
+{
+    assert(m_track_cov);
+    assert(m_n > 1);
+    cov = m_comoment / (m_n - 1);
+}
+
+void Accumulator::get_moments(arma::vec &mo1_est,
+                              arma::vec &mo2_est)
+{
+    mo1_est = m_mean;
+    mo2_est = m_m2 / m_n + m_mean % m_mean;
+}
+
+double Accumulator::get_fcn_mean(const int i)
+{
+    assert((i >= 0) && (i < (int)m_fcns.size()));
+    return m_fcn_means[i];
+}
+
+void Accumulator::save(std::ostream &out)
+{
+    write_value(out, m_dimension);
+    write_value(out, m_track_cov);
+    write_value(out, m_n);
+    write_mat(out, m_mean);
+    write_mat(out, m_m2);
+    if (m_track_cov) write_mat(out, m_comoment);
+    write_value(out, (int)m_fcn_means.size());
+    for (std::size_t k = 0; k < m_fcn_means.size(); ++k)
+    {
+        write_value(out, m_fcn_means[k]);
+    }
+}
+
+void Accumulator::load(std::istream &in)
+{
+    int dimension = 0, track_cov = 0, n_fcns = 0;
+    read_value(in, dimension);
+    read_value(in, track_cov);
+    assert(dimension == m_dimension);
+    assert(track_cov == m_track_cov);
+    read_value(in, m_n);
+    read_mat(in, m_mean);
+    read_mat(in, m_m2);
+    if (m_track_cov) read_mat(in, m_comoment);
+    read_value(in, n_fcns);
+    assert(n_fcns == (int)m_fcn_means.size());
+    for (std::size_t k = 0; k < m_fcn_means.size(); ++k)
+    {
+        read_value(in, m_fcn_means[k]);
+    }
+}
@@ -0,0 +1,107 @@
+/* Class representing an ensemble of Markov chains run in parallel
+ */
+#include "chain_ensemble.h"
+#include "convergence_monitor.h"
+#include "mcmc.h"
+#include "thread_pool.h"
+#include <armadillo>
+#include <cassert>
+#include <memory>
+
+int ChainEnsemble::get_n_chains()
+{
+    return m_chains.size();
+}
+
+int ChainEnsemble::get_n_threads()
+{
+    return m_n_threads;
+}
+
+MCMC& ChainEnsemble::get_chain(const int i)
+{
+    assert((i >= 0) && (i < get_n_chains()));
+    return *m_chains[i];
+}
+
+void ChainEnsemble::run()
+{
+    int n_chains = get_n_chains();
+    assert(n_chains > 0);
+    
+    int store_samples = stores_samples();
+    m_samples.set_size(m_chains[0]->get_dimension(),
+                       store_samples ? m_chains[0]->get_n_samples() : 0,
+                       n_chains);
+    
+    // Each chain only touches its own state and slice of m_samples
+    pool().parallel_for(n_chains, [this, store_samples](int i){
+        MCMC &chain = *m_chains[i];
+        if (store_samples) chain.set_sample_memory(m_samples.slice(i).memptr());
+        chain.run();
+        chain.set_sample_memory(nullptr);
+    });
+}
+
+int ChainEnsemble::run_until_converged(const double target_ess,
+                                       const double max_rhat,
+                                       const int check_interval)
+{
+    int n_chains = get_n_chains();
+    assert(n_chains > 0);
+    assert(check_interval > 0);
+    
+    // Each chain adds its samples to its own part of the monitor
+    ConvergenceMonitor monitor(m_chains[0]->get_dimension(), n_chains);
+    for (int i = 0; i < n_chains; ++i) m_chains[i]->set_monitor(&monitor, i);
+    
+    // Chains follow the same schedule, so all finish together. The first
+    // step also completes the burn-in period.
+    long long n_steps = m_chains[0]->get_burn() +
+                        (long long)check_interval * m_chains[0]->get_thin();
+    int converged = 0;
+    do
+    {
+        pool().parallel_for(n_chains, [this, n_steps](int i){
+            m_chains[i]->step(n_steps);
+        });
+        n_steps = (long long)check_interval * m_chains[0]->get_thin();
+        converged = monitor.converged(target_ess, max_rhat);
+    } while (m_chains[0]->is_running() && !converged);
+    
+    for (int i = 0; i < n_chains; ++i)
+    {
+        m_chains[i]->finish();
+        m_chains[i]->set_monitor(nullptr);
+    }
+    
+    int store_samples = stores_samples();
+    m_samples.set_size(m_chains[0]->get_dimension(),
+                       store_samples ? m_chains[0]->get_n_recorded() : 0,
+                       n_chains);
+    for (int i = 0; store_samples && (i < n_chains); ++i)
+    {
+        m_samples.slice(i) = m_chains[i]->get_samples();
+    }
+    return converged;
+}
+
+ThreadPool& ChainEnsemble::pool()
+{
+    if (!m_pool) m_pool = std::make_shared<ThreadPool>(m_n_threads);
+    return *m_pool;
+}
+
+int ChainEnsemble::stores_samples()
+{
+    for (auto &chain : m_chains)
+    {
+        if (!chain->get_store_samples()) return 0;
+    }
+    return 1;
+}
+
+const arma::cube& ChainEnsemble::get_samples()
+{
+    return m_samples;
+}
@@ -0,0 +1,266 @@
+/* Classes for writing a Markov chain to, and reading it from, a binary file
+ */
+#include "chain_io.h"
+#include <armadillo>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static const char chain_magic[8] = { 'M', 'C', 'M', 'C', 'C', 'H', 'N', '1' };
+static const int chain_header_size = 8 + 4 * sizeof(std::uint32_t);
+
+ChainWriter::ChainWriter(const std::string &filename,
+                         const int dimension,
+                         const int chain_id,
+                         const int thin,
+                         const int single_precision,
+                         const int block_size,
+                         const int append)
+    : m_filename{ filename },
+    m_dimension{ dimension },
+    m_single_precision{ single_precision },
+    m_block_size{ block_size },
+    m_n_buffered{ 0 },
+    m_n_samples{ 0 }
+{
+    assert(dimension > 0);
+    assert(block_size > 0);
+    if (m_single_precision){
+        m_buffer_float.resize(m_dimension * m_block_size);
+    } else {
+        m_buffer.resize(m_dimension * m_block_size);
+    }
+    
+    if (append){
+        long long n_existing = count_existing();
+        if (n_existing == -2){
+            std::cerr << filename << " isn't a chain of the same dimension "
+                      << "and precision\n";
+            return;
+        }
+        if (n_existing >= 0){
+            // Opening then truncating discards any partly written sample
+            m_n_samples = n_existing;
+            m_file.open(filename, std::ios::binary | std::ios::app);
+            if (!m_file.is_open() || !truncate(n_existing)){
+                std::cerr << "Unable to open " << filename << '\n';
+            }
+            return;
+        }
+    }
+    
+    m_file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!m_file.is_open()){
+        std::cerr << "Unable to open " << filename << '\n';
+        return;
+    }
+    
+    std::uint32_t header[4] = { (std::uint32_t)dimension,
+                                (std::uint32_t)chain_id,
+                                (std::uint32_t)thin,
+                                (std::uint32_t)(single_precision ?
+                                                sizeof(float) :
+                                                sizeof(double)) };
+    m_file.write(chain_magic, sizeof(chain_magic));
+    m_file.write(reinterpret_cast<const char*>(header), sizeof(header));
+}
+
+ChainWriter::~ChainWriter()
+{
+    close();
+}
+
+int ChainWriter::is_open()
+{
+    return m_file.is_open();
+}
+
+void ChainWriter::write(const arma::vec &sample)
+{
+    assert((int)sample.n_elem == m_dimension);
+    if (!m_file.is_open()) return;
+    int offset = m_n_buffered * m_dimension;
+    if (m_single_precision){
+        for (int i = 0; i < m_dimension; ++i)
+        {
+            m_buffer_float[offset + i] = sample[i];
+        }
+    } else {
+        std::memcpy(&m_buffer[offset], sample.memptr(),
+                    m_dimension * sizeof(double));
+    }
+    ++m_n_samples;
+    if (++m_n_buffered == m_block_size) flush();
+}
+
+void ChainWriter::flush()
+{
+    if (!m_file.is_open()) return;
+    if (m_n_buffered > 0){
+        if (m_single_precision){
+            m_file.write(reinterpret_cast<const char*>(m_buffer_float.data()),
+                         m_n_buffered * m_dimension * sizeof(float));
+        } else {
+            m_file.write(reinterpret_cast<const char*>(m_buffer.data()),
+                         m_n_buffered * m_dimension * sizeof(double));
+        }
+        m_n_buffered = 0;
+    }
+    m_file.flush();
+}
+
+void ChainWriter::close()
+{
+    if (m_file.is_open()){
+        flush();
+        m_file.close();
+    }
+}
+
+long long ChainWriter::get_n_samples()
+{
+    return m_n_samples;
+}
+
+int ChainWriter::truncate(const long long n_samples)
+{
+    if (!m_file.is_open()) return 0;
+    flush();
+    if ((n_samples < 0) || (n_samples > m_n_samples)){
+        std::cerr << m_filename << " has fewer than " << n_samples
+                  << " samples\n";
+        return 0;
+    }
+    
+    m_file.close();
+    std::error_code ec;
+    std::filesystem::resize_file(m_filename,
+                                 chain_header_size + n_samples * sample_bytes(),
+                                 ec);
+    m_file.open(m_filename, std::ios::binary | std::ios::app);
+    if (ec || !m_file.is_open()){
+        std::cerr << "Unable to truncate " << m_filename << '\n';
+        return 0;
+    }
+    m_n_samples = n_samples;
+    return 1;
+}
+
+long long ChainWriter::sample_bytes()
+{
+    return (long long)m_dimension *
+           (m_single_precision ? sizeof(float) : sizeof(double));
+}
+
+long long ChainWriter::count_existing()
+{
+    std::ifstream file(m_filename, std::ios::binary);
+    if (!file.is_open()) return -1;
+    
+    char magic[sizeof(chain_magic)];
+    std::uint32_t header[4];
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!file || std::memcmp(magic, chain_magic, sizeof(magic)) != 0 ||
+        (int)header[0] != m_dimension ||
+        header[3] != (m_single_precision ? sizeof(float) : sizeof(double))){
+        return -2;
+    }
+    
+    file.seekg(0, std::ios::end);
+    long long n_bytes = (long long)file.tellg() - chain_header_size;
+    return n_bytes / sample_bytes();
+}
+
+ChainReader::ChainReader(const std::string &filename)
+    : m_file{ filename, std::ios::binary },
+    m_dimension{ 0 },
+    m_chain_id{ 0 },
+    m_thin{ 0 },
+    m_value_size{ 0 },
+    m_valid{ 0 },
+    m_n_samples{ 0 },
+    m_n_read{ 0 }
+{
+    if (!m_file.is_open()){
+        std::cerr << "Unable to open " << filename << '\n';
+        return;
+    }
+    
+    char magic[sizeof(chain_magic)];
+    std::uint32_t header[4];
+    m_file.read(magic, sizeof(magic));
+    m_file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!m_file || std::memcmp(magic, chain_magic, sizeof(magic)) != 0 ||
+        header[0] == 0 ||
+        (header[3] != sizeof(double) && header[3] != sizeof(float))){
+        std::cerr << filename << " is not a chain written by ChainWriter\n";
+        return;
+    }
+    
+    m_dimension = header[0];
+    m_chain_id = header[1];
+    m_thin = header[2];
+    m_value_size = header[3];
+    
+    // Count the samples from the size of the file
+    m_file.seekg(0, std::ios::end);
+    long long n_bytes = (long long)m_file.tellg() - chain_header_size;
+    m_n_samples = n_bytes / ((long long)m_dimension * m_value_size);
+    m_file.seekg(chain_header_size, std::ios::beg);
+    m_valid = 1;
+}
+
+int ChainReader::is_open()
+{
+    return m_valid;
+}
+
+int ChainReader::get_dimension()
+{
+    return m_dimension;
+}
+
+int ChainReader::get_chain_id()
+{
+    return m_chain_id;
+}
+
+int ChainReader::get_thin()
+{
+    return m_thin;
+}
+
+long long ChainReader::get_n_samples()
+{
+    return m_n_samples;
+}
+
+long long ChainReader::read(arma::mat &samples,
+                            const long long n_samples)
+{
+    long long n = m_n_samples - m_n_read;
+    if ((n_samples >= 0) && (n_samples < n)) n = n_samples;
+    if (!m_valid) n = 0;
+    
+    samples.set_size(m_dimension, n);
+    if (n == 0) return 0;
+    
+    if (m_value_size == sizeof(double)){
+        m_file.read(reinterpret_cast<char*>(samples.memptr()),
+                    n * m_dimension * sizeof(double));
+    } else {
+        std::vector<float> buffer(n * m_dimension);
+        m_file.read(reinterpret_cast<char*>(buffer.data()),
+                    n * m_dimension * sizeof(float));
+        double *mem = samples.memptr();
+        for (long long i = 0; i < n * m_dimension; ++i) mem[i] = buffer[i];
+    }
+    m_n_read += n;
+    return n;
+}
@@ -0,0 +1,45 @@
+/* Functions for writing the state of a sampler to, and reading it from, a
+ * binary checkpoint
+ */
+#include "checkpoint.h"
+#include <armadillo>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+void write_string(std::ostream &out,
+                  const std::string &s)
+{
+    write_value(out, (std::uint64_t)s.size());
+    out.write(s.data(), s.size());
+}
+
+void read_string(std::istream &in,
+                 std::string &s)
+{
+    std::uint64_t size = 0;
+    read_value(in, size);
+    if (!in) return;
+    s.resize(size);
+    in.read(&s[0], size);
+}
+
+void write_mat(std::ostream &out,
+               const arma::mat &x)
+{
+    write_value(out, (std::uint64_t)x.n_rows);
+    write_value(out, (std::uint64_t)x.n_cols);
+    out.write(reinterpret_cast<const char*>(x.memptr()),
+              x.n_elem * sizeof(double));
+}
+
+void read_mat(std::istream &in,
+              arma::mat &x)
+{
+    std::uint64_t n_rows = 0, n_cols = 0;
+    read_value(in, n_rows);
+    read_value(in, n_cols);
+    if (!in) return;
+    x.set_size(n_rows, n_cols);
+    in.read(reinterpret_cast<char*>(x.memptr()), x.n_elem * sizeof(double));
+}
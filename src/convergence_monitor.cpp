@@ -0,0 +1,234 @@
+/* Class monitoring the convergence of one or more Markov chains from a
+ * stream of samples
+ */
+#include "convergence_monitor.h"
+#include <armadillo>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+ConvergenceMonitor::ConvergenceMonitor(const int dimension,
+                                       const int n_chains,
+                                       const int n_batches)
+    : m_dimension{ dimension },
+    m_n_chains{ n_chains },
+    m_max_batches{ n_batches }
+{
+    assert(dimension > 0);
+    assert(n_chains > 0);
+    assert((n_batches >= 8) && (n_batches % 2 == 0));
+    m_chains.resize(m_n_chains);
+    for (ChainBatches &c : m_chains)
+    {
+        c.mean.set_size(m_dimension, m_max_batches);
+        c.m2.set_size(m_dimension, m_max_batches);
+        c.partial_mean.set_size(m_dimension);
+        c.partial_m2.set_size(m_dimension);
+    }
+    reset();
+}
+
+void ConvergenceMonitor::add(const int chain,
+                             const arma::vec &x)
+{
+    assert((chain >= 0) && (chain < m_n_chains));
+    assert((int)x.n_elem == m_dimension);
+    ChainBatches &c = m_chains[chain];
+    ++c.n;
+    ++c.n_partial;
+    
+    // Welford's update of the incomplete batch
+    double w = 1.0 / c.n_partial;
+    for (int i = 0; i < m_dimension; ++i)
+    {
+        double delta = x[i] - c.partial_mean[i];
+        c.partial_mean[i] += w * delta;
+        c.partial_m2[i] += delta * (x[i] - c.partial_mean[i]);
+    }
+    if (c.n_partial < c.batch_size) return;
+    
+    // Batch complete
+    c.mean.col(c.n_batches) = c.partial_mean;
+    c.m2.col(c.n_batches) = c.partial_m2;
+    ++c.n_batches;
+    c.partial_mean.zeros();
+    c.partial_m2.zeros();
+    c.n_partial = 0;
+    if (c.n_batches == m_max_batches) merge_batches(c);
+}
+
+void ConvergenceMonitor::reset()
+{
+    for (ChainBatches &c : m_chains)
+    {
+        c.n = 0;
+        c.batch_size = 1;
+        c.n_batches = 0;
+        c.n_partial = 0;
+        c.partial_mean.zeros();
+        c.partial_m2.zeros();
+    }
+}
+
+int ConvergenceMonitor::get_dimension()
+{
+    return m_dimension;
+}
+
+int ConvergenceMonitor::get_n_chains()
+{
+    return m_n_chains;
+}
+
+long long ConvergenceMonitor::get_n(const int chain)
+{
+    assert((chain >= 0) && (chain < m_n_chains));
+    return m_chains[chain].n;
+}
+
+void ConvergenceMonitor::get_ess(arma::vec &ess)
+{
+    ess.zeros(m_dimension);
+    for (const ChainBatches &c : m_chains)
+    {
+        if (c.n_batches < 4){
+            ess.zeros();
+            return;
+        }
+    }
+    
+    arma::vec mean, var;
+    for (const ChainBatches &c : m_chains)
+    {
+        int a = c.n_batches - c.n_batches % 2;
+        double n = (double)a * c.batch_size;
+        batch_moments(c, 0, a, mean, var);
+        
+        // The variance of the batch means, times the batch size, estimates
+        // the asymptotic variance of the mean of the chain
+        for (int i = 0; i < m_dimension; ++i)
+        {
+            double ss = 0.0;
+            for (int k = 0; k < a; ++k)
+            {
+                double delta = c.mean(i, k) - mean[i];
+                ss += delta * delta;
+            }
+            double asym_var = c.batch_size * ss / (a - 1);
+            ess[i] += (asym_var > 0.0) ? n * var[i] / asym_var : n;
+        }
+    }
+}
+
+void ConvergenceMonitor::get_split_rhat(arma::vec &rhat)
+{
+    rhat.set_size(m_dimension);
+    rhat.fill(std::numeric_limits<double>::infinity());
+    for (const ChainBatches &c : m_chains)
+    {
+        if (c.n_batches < 4) return;
+    }
+    
+    // Means and variances of the halves of each chain
+    int m = 2 * m_n_chains;
+    arma::mat half_means(m_dimension, m), half_vars(m_dimension, m);
+    arma::vec mean, var;
+    double n_half = 0.0;
+    for (int j = 0; j < m_n_chains; ++j)
+    {
+        const ChainBatches &c = m_chains[j];
+        int h = c.n_batches / 2;
+        batch_moments(c, 0, h, mean, var);
+        half_means.col(2*j) = mean;
+        half_vars.col(2*j) = var;
+        batch_moments(c, h, h, mean, var);
+        half_means.col(2*j + 1) = mean;
+        half_vars.col(2*j + 1) = var;
+        n_half += (double)h * c.batch_size / m_n_chains;
+    }
+    
+    for (int i = 0; i < m_dimension; ++i)
+    {
+        double W = 0.0, mean_of_means = 0.0;
+        for (int j = 0; j < m; ++j)
+        {
+            W += half_vars(i, j) / m;
+            mean_of_means += half_means(i, j) / m;
+        }
+        double B_over_n = 0.0;
+        for (int j = 0; j < m; ++j)
+        {
+            double delta = half_means(i, j) - mean_of_means;
+            B_over_n += delta * delta / (m - 1);
+        }
+        
+        if (W > 0.0){
+            double var_plus = (n_half - 1.0) / n_half * W + B_over_n;
+            rhat[i] = std::sqrt(var_plus / W);
+        } else if (B_over_n == 0.0){
+            rhat[i] = 1.0;
+        }
+    }
+}
+
+int ConvergenceMonitor::converged(const double target_ess,
+                                  const double max_rhat)
+{
+    arma::vec ess, rhat;
+    get_ess(ess);
+    get_split_rhat(rhat);
+    for (int i = 0; i < m_dimension; ++i)
+    {
+        if ((ess[i] < target_ess) || !(rhat[i] < max_rhat)) return 0;
+    }
+    return 1;
+}
+
+void ConvergenceMonitor::merge_batches(ChainBatches &c)
+{
+    // Merging two batches of size b whose means differ by delta adds
+    // (b / 2) * delta^2 to the sum of squared deviations
+    int n_merged = c.n_batches / 2;
+    double half_b = 0.5 * c.batch_size;
+    for (int k = 0; k < n_merged; ++k)
+    {
+        for (int i = 0; i < m_dimension; ++i)
+        {
+            double mean_a = c.mean(i, 2*k);
+            double mean_b = c.mean(i, 2*k + 1);
+            double delta = mean_b - mean_a;
+            c.mean(i, k) = 0.5 * (mean_a + mean_b);
+            c.m2(i, k) = c.m2(i, 2*k) + c.m2(i, 2*k + 1) +
+                         half_b * delta * delta;
+        }
+    }
+    c.n_batches = n_merged;
+    c.batch_size *= 2;
+}
+
+void ConvergenceMonitor::batch_moments(const ChainBatches &c,
+                                       const int first,
+                                       const int n,
+                                       arma::vec &mean,
+                                       arma::vec &var)
+{
+    // Batches are of equal size, so the mean is the mean of the batch
+    // means, and the sum of squared deviations combines those within and
+    // between batches
+    mean.zeros(m_dimension);
+    var.zeros(m_dimension);
+    for (int k = first; k < first + n; ++k)
+    {
+        for (int i = 0; i < m_dimension; ++i) mean[i] += c.mean(i, k) / n;
+    }
+    for (int k = first; k < first + n; ++k)
+    {
+        for (int i = 0; i < m_dimension; ++i)
+        {
+            double delta = c.mean(i, k) - mean[i];
+            var[i] += c.m2(i, k) + c.batch_size * delta * delta;
+        }
+    }
+    var /= (double)n * c.batch_size - 1.0;
+}
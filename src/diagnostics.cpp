@@ -0,0 +1,206 @@
+/* Functions for diagnosing the convergence and efficiency of Markov chains
+ */
+#include "diagnostics.h"
+#include <armadillo>
+#include <cassert>
+#include <cmath>
+
+/* View the samples of a single chain as a cube with one slice,
+ * without copying them
+ */
+static arma::cube as_cube(const arma::mat &samples)
+{
+    return arma::cube(const_cast<double*>(samples.memptr()),
+                      samples.n_rows, samples.n_cols, 1, false, true);
+}
+
+/* Autocovariances (normalised by the length of x) of x at lags
+ * 0, 1, ..., x.n_elem-1, computed using the fast Fourier transform
+ *
+ * x    : Component of a chain
+ * acov : The autocovariances
+ */
+static void autocov(const arma::vec &x,
+                    arma::vec &acov)
+{
+    arma::uword n = x.n_elem;
+    
+    // Zero-pad to a power of two at least 2n, so that the circular
+    // correlation computed equals the linear one
+    arma::uword n_fft = 1;
+    while (n_fft < 2*n) n_fft *= 2;
+    
+    arma::cx_vec f = arma::fft(arma::vec(x - arma::mean(x)), n_fft);
+    arma::vec power = arma::square(arma::abs(f));
+    arma::cx_vec g = arma::ifft(arma::cx_vec(power,
+                                             arma::zeros<arma::vec>(n_fft)));
+    acov = arma::real(g.head(n)) / n;
+}
+
+/* Autocovariances and means of component i of each chain
+ *
+ * samples    : Samples of the chains
+ * i          : Component
+ * acov       : n_samples x n_chains matrix of autocovariances
+ * chain_mean : Mean of each chain
+ */
+static void chain_autocov(const arma::cube &samples,
+                          const arma::uword i,
+                          arma::mat &acov,
+                          arma::vec &chain_mean)
+{
+    arma::uword n = samples.n_cols;
+    arma::uword n_chains = samples.n_slices;
+    acov.set_size(n, n_chains);
+    chain_mean.set_size(n_chains);
+    
+    arma::vec x(n), acov_m;
+    for (arma::uword m = 0; m < n_chains; ++m)
+    {
+        x = samples.slice(m).row(i).t();
+        chain_mean[m] = arma::mean(x);
+        autocov(x, acov_m);
+        acov.col(m) = acov_m;
+    }
+}
+
+/* Effective sample size from the autocovariances and means of
+ * one component of several chains
+ *
+ * acov       : n_samples x n_chains matrix of autocovariances
+ * chain_mean : Mean of each chain
+ */
+static double ess_from_autocov(const arma::mat &acov,
+                               const arma::vec &chain_mean)
+{
+    double n = acov.n_rows;
+    arma::uword n_chains = acov.n_cols;
+    
+    // Within-chain variance and the estimate of the marginal variance
+    double W = arma::mean(acov.row(0)) * n / (n - 1.0);
+    double var_plus = W * (n - 1.0) / n;
+    if (n_chains > 1) var_plus += arma::var(chain_mean);
+    if (!(var_plus > 0)) return arma::datum::nan;
+    
+    // Combined autocorrelations
+    arma::vec rho = 1.0 - (W - arma::mean(acov, 1)) / var_plus;
+    rho[0] = 1.0;
+    
+    // Geyer's initial monotone sequence: sum the sums of pairs of
+    // consecutive autocorrelations while they are positive, forcing them
+    // to decrease
+    double tau = -1.0;
+    double prev_pair = 2.0;
+    for (arma::uword k = 0; 2*k + 1 < rho.n_elem; ++k)
+    {
+        double pair = rho[2*k] + rho[2*k + 1];
+        if (pair < 0) break;
+        if (pair > prev_pair) pair = prev_pair;
+        tau += 2.0 * pair;
+        prev_pair = pair;
+    }
+    
+    // Guard against a tiny (or negative) estimate for anti-correlated chains
+    double n_total = n * n_chains;
+    double tau_min = 1.0 / std::log10(n_total);
+    if (tau < tau_min) tau = tau_min;
+    
+    return n_total / tau;
+}
+
+arma::mat acf(const arma::mat &samples,
+              const int max_lag)
+{
+    assert((max_lag >= 0) && (max_lag < (int)samples.n_cols));
+    
+    arma::mat acfs(max_lag + 1, samples.n_rows);
+    arma::vec x, acov;
+    for (arma::uword i = 0; i < samples.n_rows; ++i)
+    {
+        x = samples.row(i).t();
+        autocov(x, acov);
+        acfs.col(i) = acov.head(max_lag + 1) / acov[0];
+    }
+    return acfs;
+}
+
+arma::vec ess(const arma::mat &samples)
+{
+    return ess(as_cube(samples));
+}
+
+arma::vec ess(const arma::cube &samples)
+{
+    assert(samples.n_cols > 1);
+    
+    arma::vec ess_est(samples.n_rows);
+    arma::mat acov;
+    arma::vec chain_mean;
+    for (arma::uword i = 0; i < samples.n_rows; ++i)
+    {
+        chain_autocov(samples, i, acov, chain_mean);
+        ess_est[i] = ess_from_autocov(acov, chain_mean);
+    }
+    return ess_est;
+}
+
+arma::vec split_rhat(const arma::mat &samples)
+{
+    return split_rhat(as_cube(samples));
+}
+
+arma::vec split_rhat(const arma::cube &samples)
+{
+    // Length of each half (the middle sample is dropped if n is odd)
+    arma::uword n = samples.n_cols;
+    arma::uword half = n / 2;
+    assert(half > 1);
+    
+    arma::uword n_halves = 2 * samples.n_slices;
+    arma::vec rhat(samples.n_rows);
+    arma::vec half_mean(n_halves), half_var(n_halves);
+    for (arma::uword i = 0; i < samples.n_rows; ++i)
+    {
+        for (arma::uword m = 0; m < samples.n_slices; ++m)
+        {
+            arma::rowvec x = samples.slice(m).row(i);
+            arma::rowvec first = x.head(half);
+            arma::rowvec second = x.tail(half);
+            half_mean[2*m] = arma::mean(first);
+            half_mean[2*m + 1] = arma::mean(second);
+            half_var[2*m] = arma::var(first);
+            half_var[2*m + 1] = arma::var(second);
+        }
+        double W = arma::mean(half_var);
+        double var_plus = W * (half - 1.0) / half + arma::var(half_mean);
+        rhat[i] = std::sqrt(var_plus / W);
+    }
+    return rhat;
+}
+
+arma::vec mcse(const arma::mat &samples)
+{
+    return mcse(as_cube(samples));
+}
+
+arma::vec mcse(const arma::cube &samples)
+{
+    arma::vec ess_est = ess(samples);
+    arma::vec se(samples.n_rows);
+    for (arma::uword i = 0; i < samples.n_rows; ++i)
+    {
+        // Variance pooled over every sample of every chain
+        double sum = 0.0, sum_sq = 0.0;
+        for (arma::uword m = 0; m < samples.n_slices; ++m)
+        {
+            arma::rowvec x = samples.slice(m).row(i);
+            sum += arma::accu(x);
+            sum_sq += arma::accu(x % x);
+        }
+        double n_total = samples.n_cols * samples.n_slices;
+        double mean = sum / n_total;
+        double var = (sum_sq - n_total * mean * mean) / (n_total - 1.0);
+        se[i] = std::sqrt(var / ess_est[i]);
+    }
+    return se;
+}
@@ -0,0 +1,91 @@
+/* Class adapting a step-size using Nesterov's dual averaging scheme
+ */
+#include "checkpoint.h"
+#include "dual_avg.h"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+
+DualAveraging::DualAveraging(const double target_accept,
+                             const double gamma,
+                             const double t0,
+                             const double kappa)
+    : m_target_accept{ target_accept },
+    m_gamma{ gamma },
+    m_t0{ t0 },
+    m_kappa{ kappa }
+{
+    assert((target_accept > 0) && (target_accept < 1));
+    restart(1.0);
+}
+
+void DualAveraging::set_target_accept(const double target_accept)
+{
+    assert((target_accept > 0) && (target_accept < 1));
+    m_target_accept = target_accept;
+}
+
+double DualAveraging::get_target_accept()
+{
+    return m_target_accept;
+}
+
+void DualAveraging::restart(const double epsilon)
+{
+    assert(epsilon > 0);
+    m_mu = log(10.0 * epsilon);
+    m_h_bar = 0.0;
+    m_log_epsilon = log(epsilon);
+    m_log_epsilon_bar = 0.0;
+    m_t = 0;
+}
+
+double DualAveraging::update(double accept_stat)
+{
+    // A diverging trajectory can give a NaN acceptance statistic
+    if (!(accept_stat >= 0)) accept_stat = 0.0;
+    if (accept_stat > 1) accept_stat = 1.0;
+    
+    ++m_t;
+    double w = 1.0 / (m_t + m_t0);
+    m_h_bar = (1.0 - w) * m_h_bar + w * (m_target_accept - accept_stat);
+    
+    m_log_epsilon = m_mu - sqrt((double)m_t) / m_gamma * m_h_bar;
+    
+    double eta = pow((double)m_t, -m_kappa);
+    m_log_epsilon_bar = eta * m_log_epsilon + (1.0 - eta) * m_log_epsilon_bar;
+    
+    return exp(m_log_epsilon);
+}
+
+double DualAveraging::get_final_step_size()
+{
+    if (m_t == 0) return exp(m_log_epsilon);
+    return exp(m_log_epsilon_bar);
+}
+
+void DualAveraging::save(std::ostream &out)
+{
+    write_value(out, m_target_accept);
+    write_value(out, m_gamma);
+    write_value(out, m_t0);
+    write_value(out, m_kappa);
+    write_value(out, m_mu);
+    write_value(out, m_h_bar);
+    write_value(out, m_log_epsilon);
+    write_value(out, m_log_epsilon_bar);
+    write_value(out, m_t);
+}
+
+void DualAveraging::load(std::istream &in)
+{
+    read_value(in, m_target_accept);
+    read_value(in, m_gamma);
+    read_value(in, m_t0);
+    read_value(in, m_kappa);
+    read_value(in, m_mu);
+    read_value(in, m_h_bar);
+    read_value(in, m_log_epsilon);
+    read_value(in, m_log_epsilon_bar);
+    read_value(in, m_t);
+}
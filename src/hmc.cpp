@@ -1,14 +1,19 @@
 /* Class representing a Markov chain generated using Hamiltonian
  * Monte Carlo */
+#include "accumulator.h"
+#include "checkpoint.h"
 #include "hmc.h"
 #include "leapfrog.h"
 #include "log_post.h"
 #include "mcmc.h"
+#include "point.h"
 #include "print.h"
 #include <armadillo>
 #include <cassert>
+#include <cmath>
 #include <iostream>
 #include <random>
+#include <utility>
 
 HMC::HMC(const int burn,
          const int thin,
@@ -17,8 +22,13 @@ HMC::HMC(const int burn,
          const int L)
 : MCMC{ burn, thin, n_samples },
 m_epsilon{ epsilon },
+m_accept_prob{ 0.0 },
 m_L{ L },
-m_number_accepts{ 0 }
+m_adapt_step_size{ 0 },
+m_adapt_metric{ Metric::UNIT },
+m_n_burn_iter{ 0 },
+m_window_end{ 0 },
+m_window_size{ 0 }
 {
 }
 
@@ -31,8 +41,14 @@ HMC::HMC(LogPost log_post,
          const int L)
 : MCMC{ log_post, initial_state, burn, thin, n_samples },
 m_epsilon{ epsilon },
+m_accept_prob{ 0.0 },
 m_L{ L },
-m_number_accepts{ 0 }
+m_adapt_step_size{ 0 },
+m_metric{ (int)initial_state.n_elem },
+m_adapt_metric{ Metric::UNIT },
+m_n_burn_iter{ 0 },
+m_window_end{ 0 },
+m_window_size{ 0 }
 {
     assert(m_posterior.is_grad_log_dens_constructed());
     m_velocity_current.set_size(m_dimension);
@@ -59,35 +75,33 @@ int HMC::get_n_steps()
     return m_L;
 }
 
-int HMC::get_n_accepts()
-{
-    return m_number_accepts;
-}
-
-void HMC::adapt_step_size()
+void HMC::adapt_step_size(const double target_accept)
 {
     // Check gradient information available
     if (!m_posterior.is_grad_log_dens_constructed()){
         std::cerr << "LogPost object doesn't contain gradient information!\n";
     }
     
-    m_epsilon = 2.00;
-    int originaL = m_L; // Save the orignal choice of number of steps
-    m_L = 100; // Make the number of steps large
-    int epsilon_sufficiently_small = 0;
-    
-    while ((m_epsilon > 0.015) && !epsilon_sufficiently_small)
-    {
-        int n_accepts = 0;
-        for (int i = 0; i < 1000; ++i) n_accepts += hmc_kern();
-        double avg_accept = n_accepts/1000.0;
-        if (avg_accept > 0.65){
-            epsilon_sufficiently_small = 1;
-        } else {
-            m_epsilon -= 0.01;
-        }
-    }
-    m_L = originaL; // Revert to orignal choice of nuber of steps
+    m_dual_avg.set_target_accept(target_accept);
+    m_dual_avg.restart(m_epsilon);
+    m_adapt_step_size = 1;
+}
+
+void HMC::adapt_metric(const Metric::Type type)
+{
+    m_adapt_metric = type;
+    m_n_burn_iter = 0;
+}
+
+void HMC::set_metric(Metric metric)
+{
+    assert(metric.get_dimension() == m_dimension);
+    m_metric = metric;
+}
+
+Metric HMC::get_metric()
+{
+    return m_metric;
 }
 
 void HMC::hmc()
@@ -97,21 +111,7 @@ void HMC::hmc()
         std::cerr << "LogPost object doesn't contain gradient information!\n";
     }
     
-    // Burn-in period
-    for (int i = 0; i < m_burn; i++) m_number_accepts += hmc_kern();
-    
-    // Post-burn-in
-    m_samples.push_back(m_current);
-    for (int i = 0; i < (m_number_samples-1); i++)
-    {
-        // Multiple applications of the Markov kernel
-        for (int j = 0; j < m_thin; j++)
-        {
-            m_number_accepts += hmc_kern();
-        }
-        m_samples.push_back(m_current);
-    }
-    m_samples_generated = 1;
+    run();
 }
 
 void HMC::gen_mo_est(arma::vec &mo1_est,
@@ -122,12 +122,11 @@ void HMC::gen_mo_est(arma::vec &mo1_est,
         std::cerr << "LogPost object doesn't contain gradient information!\n";
     }
     
-    // Make sure moment estimates have correct dimension
-    mo1_est.zeros(m_dimension);
-    mo2_est.zeros(m_dimension);
+    Accumulator acc(m_dimension);
     
-    // Burn-in period
-    for (int i = 0; i < m_burn; ++i) m_number_accepts += hmc_kern();
+    // Burn-in period, adapting the step-size and metric if requested
+    for (int i = 0; i < m_burn; ++i) m_number_accepts += apply_kern(1);
+    end_burn();
     
     // Post-burn-in
     for (int i = 0; i < m_number_samples; ++i)
@@ -135,46 +134,183 @@ void HMC::gen_mo_est(arma::vec &mo1_est,
         // Multiple applications of the Markov kernel
         for (int j = 0; j < m_thin; ++j)
         {
-            m_number_accepts += hmc_kern();
+            m_number_accepts += apply_kern(0);
+        }
+        acc.add(m_current);
+    }
+    
+    acc.get_moments(mo1_est, mo2_est);
+}
+
+int HMC::kern()
+{
+    return hmc_kern();
+}
+
+int HMC::burn_kern()
+{
+    int accept = hmc_kern();
+    if (m_adapt_step_size) m_epsilon = m_dual_avg.update(m_accept_prob);
+    if (m_adapt_metric != Metric::UNIT) adapt_metric_window();
+    ++m_n_burn_iter;
+    return accept;
+}
+
+void HMC::end_burn()
+{
+    if (m_adapt_step_size){
+        m_epsilon = m_dual_avg.get_final_step_size();
+        m_adapt_step_size = 0;
+    }
+    m_adapt_metric = Metric::UNIT;
+    m_n_burn_iter = 0;
+}
+
+void HMC::save_state(std::ostream &out)
+{
+    write_value(out, m_epsilon);
+    write_value(out, m_L);
+    write_value(out, m_adapt_step_size);
+    m_dual_avg.save(out);
+    m_metric.save(out);
+    write_value(out, m_adapt_metric);
+    write_value(out, m_n_burn_iter);
+    write_value(out, m_window_end);
+    write_value(out, m_window_size);
+    
+    // The window's moments are only in use part-way through adapting the
+    // metric
+    int window_started = (m_adapt_metric != Metric::UNIT) &&
+                         (m_n_burn_iter > 0);
+    write_value(out, window_started);
+    if (window_started) m_window_acc.save(out);
+}
+
+void HMC::load_state(std::istream &in)
+{
+    read_value(in, m_epsilon);
+    read_value(in, m_L);
+    read_value(in, m_adapt_step_size);
+    m_dual_avg.load(in);
+    m_metric.load(in);
+    read_value(in, m_adapt_metric);
+    read_value(in, m_n_burn_iter);
+    read_value(in, m_window_end);
+    read_value(in, m_window_size);
+    
+    int window_started = 0;
+    read_value(in, window_started);
+    if (window_started){
+        m_window_acc = Accumulator(m_dimension,
+                                   m_adapt_metric == Metric::DENSE);
+        m_window_acc.load(in);
+    }
+}
+
+void HMC::adapt_metric_window()
+{
+    // Initial buffer (adapting the step-size only), first window length,
+    // terminal buffer (adapting the step-size to the final metric)
+    int init_buffer = 75, window_size = 25, term_buffer = 50;
+    if (m_burn < init_buffer + window_size + term_buffer){
+        init_buffer = 0.15 * m_burn;
+        term_buffer = 0.1 * m_burn;
+        window_size = m_burn - init_buffer - term_buffer;
+    }
+    int last = m_burn - term_buffer - 1; // Last iteration of the last window
+    
+    if (m_n_burn_iter == 0){
+        if (window_size < 10){
+            std::cerr << "Burn-in period too short to adapt the metric\n";
+            m_adapt_metric = Metric::UNIT;
+            return;
         }
-        mo1_est += m_current;
-        mo2_est += m_current % m_current;
+        m_window_size = window_size;
+        m_window_end = init_buffer + window_size - 1;
+        m_window_acc = Accumulator(m_dimension, m_adapt_metric == Metric::DENSE);
     }
+    if ((m_n_burn_iter < init_buffer) || (m_n_burn_iter > last)) return;
+    
+    m_window_acc.add(m_current);
+    if (m_n_burn_iter < m_window_end) return;
+    
+    // End of a window: set the metric to a regularized estimate of the
+    // covariance, shrunk towards a small multiple of the identity
+    double n = m_window_acc.get_n();
+    double shrink = 5.0 / (n + 5.0);
+    if (m_adapt_metric == Metric::DENSE){
+        arma::mat cov;
+        m_window_acc.get_cov(cov);
+        cov *= (1.0 - shrink);
+        cov.diag() += 1e-3 * shrink;
+        m_metric.set_dense(cov);
+    } else {
+        arma::vec var;
+        m_window_acc.get_var(var);
+        m_metric.set_diag((1.0 - shrink) * var + 1e-3 * shrink);
+    }
+    m_window_acc.reset();
+    
+    // The step-size suited to the old metric may not suit the new one
+    if (m_adapt_step_size) m_dual_avg.restart(m_epsilon);
     
-    mo1_est /= m_number_samples;
-    mo2_est /= m_number_samples;
+    // Next window is twice as long, extended to the end of the last window
+    // if the one after would not fit
+    m_window_size *= 2;
+    m_window_end = m_n_burn_iter + m_window_size;
+    if (m_window_end + 2 * m_window_size > last) m_window_end = last;
 }
 
 int HMC::hmc_kern()
 {
-    m_prop = m_current;
+    // A chain constructed without a posterior, or given an initial state
+    // of another dimension since, starts with the identity metric
+    if (m_metric.get_dimension() != m_dimension){
+        m_metric = Metric(m_dimension);
+    }
     
-    // Gibbs update of the velocity
-    std::normal_distribution<double> rnorm(0.0, 1.0);
-    for (arma::vec::iterator it = m_velocity_current.begin();
-         it != m_velocity_current.end(); ++it)
+    // Evaluate the log-density and gradient at the current state, unless
+    // they are still cached from a previous application of the kernel
+    if (!m_current_cached)
     {
-        *it = rnorm(m_gen);
+        m_point_current.x = m_current;
+        m_point_current.log_dens = m_posterior.log_dens_and_grad(
+            m_current, m_point_current.grad);
+        m_current_cached = 1;
     }
+    m_point_prop = m_point_current;
+    
+    // Gibbs update of the velocity
+    m_metric.sample_velocity(m_gen, m_velocity_current);
     
     m_velocity_prop = m_velocity_current;
-    leapfrog_transform(m_prop, m_velocity_prop, m_posterior, m_epsilon, m_L);
+    leapfrog_transform(m_point_prop, m_velocity_prop, m_posterior, m_epsilon, m_L,
+                       m_metric);
     
+    return accept_proposal();
+}
+
+int HMC::accept_proposal()
+{
     // Compute acceptance probability
-    double current_U = m_posterior.U(m_current);
-    double current_K = 0.5 * arma::sum(arma::dot(m_velocity_current, m_velocity_current));
-    double prop_U = m_posterior.U(m_prop);
-    double prop_K = 0.5 * arma::sum(arma::dot(m_velocity_prop, m_velocity_prop));
+    double current_U = -m_point_current.log_dens;
+    double current_K = m_metric.kinetic(m_velocity_current);
+    double prop_U = -m_point_prop.log_dens;
+    double prop_K = m_metric.kinetic(m_velocity_prop);
     double log_accept_prob = current_U - prop_U + current_K - prop_K;
+    // A diverging trajectory can give a NaN, which must count as a rejection
+    if (std::isnan(log_accept_prob)) log_accept_prob = -arma::datum::inf;
+    m_accept_prob = (log_accept_prob < 0) ? exp(log_accept_prob) : 1.0;
     
     // Accept or reject
-    std::uniform_real_distribution<double> runif(0.0, 1.0);
-    double u = runif(m_gen);
+    double u = m_gen.uniform();
     
+    // On rejection the cached evaluations at m_current remain valid
     int accept = 0;
     if (log(u) < log_accept_prob)
     {
-        m_current = m_prop;
+        std::swap(m_point_current, m_point_prop);
+        m_current = m_point_current.x;
         accept = 1;
     }
     
@@ -2,6 +2,8 @@
  */
 #include "leapfrog.h"
 #include "log_post.h"
+#include "metric.h"
+#include "point.h"
 #include <armadillo>
 
 void leapfrog_transform(arma::vec &x,
@@ -10,7 +12,21 @@ void leapfrog_transform(arma::vec &x,
                         double epsilon,
                         int L)
 {
-    arma::vec grad(x.n_elem);
+    // Kept between calls (one per thread), so that only a change of
+    // dimension allocates memory
+    static thread_local arma::vec grad;
+    leapfrog_transform(x, v, posterior, epsilon, L, grad);
+}
+
+void leapfrog_transform(arma::vec &x,
+                        arma::vec &v,
+                        LogPost &posterior,
+                        double epsilon,
+                        int L,
+                        arma::vec &grad)
+{
+    grad.set_size(x.n_elem);
+    
     // Half-step update of velocity
     posterior.update_grad_U(x, grad);
     v -= 0.5 * epsilon * grad;
@@ -34,6 +50,79 @@ void leapfrog_transform(arma::vec &x,
     v -= 0.5 * epsilon * grad;
 }
 
+void leapfrog_transform(Point &z,
+                        arma::vec &v,
+                        LogPost &posterior,
+                        double epsilon,
+                        int L)
+{
+    // Half-step update of velocity, using the cached gradient
+    v += 0.5 * epsilon * z.grad;
+    
+    // Alternate full steps for position and velocity
+    for (int i = 0; i < L; ++i)
+    {
+        // Full step for position
+        z.x += epsilon * v;
+        
+        // Full step for velocity (except at end of trajectory, where the
+        // log density is needed as well as the gradient)
+        if (i < (L-1))
+        {
+            posterior.update_grad_log_dens(z.x, z.grad);
+            v += epsilon * z.grad;
+        } else {
+            z.log_dens = posterior.log_dens_and_grad(z.x, z.grad);
+        }
+    }
+    
+    // Half-step update of velocity
+    v += 0.5 * epsilon * z.grad;
+}
+
+void leapfrog_transform(Point &z,
+                        arma::vec &v,
+                        LogPost &posterior,
+                        double epsilon,
+                        int L,
+                        Metric &metric)
+{
+    // Half-step update of velocity, using the cached gradient
+    v += 0.5 * epsilon * z.grad;
+    
+    // Alternate full steps for position and velocity
+    for (int i = 0; i < L; ++i)
+    {
+        // Full step for position
+        metric.update_position(z.x, v, epsilon);
+        
+        // Full step for velocity (except at end of trajectory, where the
+        // log density is needed as well as the gradient)
+        if (i < (L-1))
+        {
+            posterior.update_grad_log_dens(z.x, z.grad);
+            v += epsilon * z.grad;
+        } else {
+            z.log_dens = posterior.log_dens_and_grad(z.x, z.grad);
+        }
+    }
+    
+    // Half-step update of velocity
+    v += 0.5 * epsilon * z.grad;
+}
+
+void leapfrog_step(Point &z,
+                   arma::vec &v,
+                   LogPost &posterior,
+                   double epsilon,
+                   Metric &metric)
+{
+    v += 0.5 * epsilon * z.grad;
+    metric.update_position(z.x, v, epsilon);
+    z.log_dens = posterior.log_dens_and_grad(z.x, z.grad);
+    v += 0.5 * epsilon * z.grad;
+}
+
 void inv_leapfrog_transform(arma::vec &x,
                             arma::vec &v,
                             LogPost &posterior,
@@ -44,3 +133,15 @@ void inv_leapfrog_transform(arma::vec &x,
     leapfrog_transform(x, v, posterior, epsilon, L);
     v *= -1;
 }
+
+void inv_leapfrog_transform(arma::vec &x,
+                            arma::vec &v,
+                            LogPost &posterior,
+                            double epsilon,
+                            int L,
+                            arma::vec &grad)
+{
+    v *= -1;
+    leapfrog_transform(x, v, posterior, epsilon, L, grad);
+    v *= -1;
+}
@@ -6,17 +6,35 @@
  */
 
 #include "log_post.h"
+#include "rng.h"
+#include "thread_pool.h"
+#include <algorithm>
 #include <armadillo>
 #include <cassert>
 #include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
 
 LogPost::LogPost(int dimension)
-    : m_dimension{ dimension },
+    : m_data{ std::make_shared<const arma::mat>() },
+    m_dimension{ dimension },
     m_log_dens_constructed{ 0 },
     m_data_constructed{ 0 },
     m_grad_log_dens_constructed{ 0 },
     m_laplacian_log_dens_constructed{ 0 },
-    m_transform_density{ 0 }
+    m_log_dens_and_grad_constructed{ 0 },
+    m_batch_log_dens_constructed{ 0 },
+    m_batch_grad_log_dens_constructed{ 0 },
+    m_transform_density{ 0 },
+    m_sum_log_lik_constructed{ 0 },
+    m_block_size{ 0 },
+    m_block_rows{ 1 },
+    m_control_variate{ 0 },
+    m_n_log_dens_evals{ 0 },
+    m_n_grad_log_dens_evals{ 0 },
+    m_log_dens_ptr{ nullptr },
+    m_grad_log_dens_ptr{ nullptr }
 {
     assert(dimension > 0);
 }
@@ -25,13 +43,24 @@ LogPost::LogPost(int dimension,
                  const arma::mat& data,
                  double (*log_dens)(const arma::vec& state,
                                     const arma::mat& data))
-    : m_data{ data },
+    : m_data{ std::make_shared<const arma::mat>(data) },
     m_dimension{ dimension },
     m_log_dens_constructed{ 1 },
     m_data_constructed{ 1 },
     m_grad_log_dens_constructed{ 0 },
     m_laplacian_log_dens_constructed{ 0 },
-    m_transform_density{ 0 }
+    m_log_dens_and_grad_constructed{ 0 },
+    m_batch_log_dens_constructed{ 0 },
+    m_batch_grad_log_dens_constructed{ 0 },
+    m_transform_density{ 0 },
+    m_sum_log_lik_constructed{ 0 },
+    m_block_size{ 0 },
+    m_block_rows{ 1 },
+    m_control_variate{ 0 },
+    m_n_log_dens_evals{ 0 },
+    m_n_grad_log_dens_evals{ 0 },
+    m_log_dens_ptr{ log_dens },
+    m_grad_log_dens_ptr{ nullptr }
 {
     assert(dimension > 0);
     m_log_dens = log_dens;
@@ -44,13 +73,24 @@ LogPost::LogPost(int dimension,
                  void (*grad_log_dens)(const arma::vec& state,
                                        arma::vec& grad,
                                        const arma::mat& data))
-    : m_data{ data },
+    : m_data{ std::make_shared<const arma::mat>(data) },
     m_dimension{ dimension },
     m_log_dens_constructed{ 1 },
     m_data_constructed{ 1 },
     m_grad_log_dens_constructed{ 1 },
     m_laplacian_log_dens_constructed{ 0 },
-    m_transform_density{ 0 }
+    m_log_dens_and_grad_constructed{ 0 },
+    m_batch_log_dens_constructed{ 0 },
+    m_batch_grad_log_dens_constructed{ 0 },
+    m_transform_density{ 0 },
+    m_sum_log_lik_constructed{ 0 },
+    m_block_size{ 0 },
+    m_block_rows{ 1 },
+    m_control_variate{ 0 },
+    m_n_log_dens_evals{ 0 },
+    m_n_grad_log_dens_evals{ 0 },
+    m_log_dens_ptr{ log_dens },
+    m_grad_log_dens_ptr{ grad_log_dens }
 {
     assert(dimension > 0);
     m_log_dens = log_dens;
@@ -66,30 +106,117 @@ LogPost::LogPost(int dimension,
                                        const arma::mat& data),
                  double (*laplacian_log_dens)(const arma::vec& state,
                                               const arma::mat& data))
-    : m_data{ data },
+    : m_data{ std::make_shared<const arma::mat>(data) },
     m_dimension{ dimension },
     m_log_dens_constructed{ 1 },
     m_data_constructed{ 1 },
     m_grad_log_dens_constructed{ 1 },
     m_laplacian_log_dens_constructed{ 1 },
-    m_transform_density{ 0 }
+    m_log_dens_and_grad_constructed{ 0 },
+    m_batch_log_dens_constructed{ 0 },
+    m_batch_grad_log_dens_constructed{ 0 },
+    m_transform_density{ 0 },
+    m_sum_log_lik_constructed{ 0 },
+    m_block_size{ 0 },
+    m_block_rows{ 1 },
+    m_control_variate{ 0 },
+    m_n_log_dens_evals{ 0 },
+    m_n_grad_log_dens_evals{ 0 },
+    m_log_dens_ptr{ log_dens },
+    m_grad_log_dens_ptr{ grad_log_dens }
+{
+    assert(dimension > 0);
+    m_log_dens = log_dens;
+    m_grad_log_dens = grad_log_dens;
+    m_laplacian_log_dens = laplacian_log_dens;
+}
+
+LogPost::LogPost(int dimension,
+                 std::shared_ptr<const arma::mat> data,
+                 double (*log_dens)(const arma::vec& state,
+                                    const arma::mat& data),
+                 void (*grad_log_dens)(const arma::vec& state,
+                                       arma::vec& grad,
+                                       const arma::mat& data),
+                 double (*laplacian_log_dens)(const arma::vec& state,
+                                              const arma::mat& data))
+    : m_data{ data },
+    m_dimension{ dimension },
+    m_log_dens_constructed{ 1 },
+    m_data_constructed{ 1 },
+    m_grad_log_dens_constructed{ grad_log_dens != nullptr },
+    m_laplacian_log_dens_constructed{ laplacian_log_dens != nullptr },
+    m_log_dens_and_grad_constructed{ 0 },
+    m_batch_log_dens_constructed{ 0 },
+    m_batch_grad_log_dens_constructed{ 0 },
+    m_transform_density{ 0 },
+    m_sum_log_lik_constructed{ 0 },
+    m_block_size{ 0 },
+    m_block_rows{ 1 },
+    m_control_variate{ 0 },
+    m_n_log_dens_evals{ 0 },
+    m_n_grad_log_dens_evals{ 0 },
+    m_log_dens_ptr{ log_dens },
+    m_grad_log_dens_ptr{ grad_log_dens }
 {
     assert(dimension > 0);
+    assert(data);
     m_log_dens = log_dens;
     m_grad_log_dens = grad_log_dens;
     m_laplacian_log_dens = laplacian_log_dens;
 }
 
+LogPost::LogPost(int dimension,
+                 LogDensFcn log_dens,
+                 GradLogDensFcn grad_log_dens)
+    : m_data{ std::make_shared<const arma::mat>() },
+    m_dimension{ dimension },
+    m_log_dens_constructed{ 1 },
+    m_data_constructed{ 0 },
+    m_grad_log_dens_constructed{ grad_log_dens != nullptr },
+    m_laplacian_log_dens_constructed{ 0 },
+    m_log_dens_and_grad_constructed{ 0 },
+    m_batch_log_dens_constructed{ 0 },
+    m_batch_grad_log_dens_constructed{ 0 },
+    m_transform_density{ 0 },
+    m_sum_log_lik_constructed{ 0 },
+    m_block_size{ 0 },
+    m_block_rows{ 1 },
+    m_control_variate{ 0 },
+    m_n_log_dens_evals{ 0 },
+    m_n_grad_log_dens_evals{ 0 },
+    m_log_dens_ptr{ nullptr },
+    m_grad_log_dens_ptr{ nullptr },
+    m_log_dens{ log_dens },
+    m_grad_log_dens{ grad_log_dens }
+{
+    assert(dimension > 0);
+    assert(log_dens);
+}
+
 void LogPost::set_data(const arma::mat& data)
 {
+    m_data = std::make_shared<const arma::mat>(data);
+    m_data_constructed = 1;
+}
+
+void LogPost::set_data(std::shared_ptr<const arma::mat> data)
+{
+    assert(data);
     m_data = data;
     m_data_constructed = 1;
 }
 
+std::shared_ptr<const arma::mat> LogPost::get_data()
+{
+    return m_data;
+}
+
 void LogPost::set_log_dens(double (*log_dens)(const arma::vec& state,
                                               const arma::mat& data))
 {
     m_log_dens = log_dens;
+    m_log_dens_ptr = log_dens;
     m_log_dens_constructed = 1;
 }
 
@@ -98,6 +225,7 @@ void LogPost::set_grad_log_dens(void (*grad_log_dens)(const arma::vec& state,
                                                       const arma::mat& data))
 {
     m_grad_log_dens = grad_log_dens;
+    m_grad_log_dens_ptr = grad_log_dens;
     m_grad_log_dens_constructed = 1;
 }
 
@@ -109,6 +237,59 @@ void LogPost::set_laplacian_log_dens(double (*laplacian_log_dens)
     m_laplacian_log_dens_constructed = 1;
 }
 
+void LogPost::set_log_dens_and_grad(LogDensAndGradFcn log_dens_and_grad)
+{
+    m_log_dens_and_grad = log_dens_and_grad;
+    m_log_dens_and_grad_constructed = 1;
+}
+
+void LogPost::set_batch_log_dens(BatchLogDensFcn batch_log_dens)
+{
+    m_batch_log_dens = batch_log_dens;
+    m_batch_log_dens_constructed = 1;
+}
+
+void LogPost::set_batch_grad_log_dens(BatchGradLogDensFcn batch_grad_log_dens)
+{
+    m_batch_grad_log_dens = batch_grad_log_dens;
+    m_batch_grad_log_dens_constructed = 1;
+}
+
+void LogPost::set_sum_log_lik(BlockLogLikFcn log_lik,
+                              BlockGradLogLikFcn grad_log_lik,
+                              LogDensFcn log_prior,
+                              GradLogDensFcn grad_log_prior,
+                              int n_threads,
+                              int block_size)
+{
+    assert(log_lik);
+    if (grad_log_lik && log_prior && !grad_log_prior){
+        std::cerr << "Gradient of the log prior hasn't been given!\n";
+    }
+    
+    m_block_log_lik = log_lik;
+    m_block_grad_log_lik = grad_log_lik;
+    m_log_prior = log_prior;
+    m_grad_log_prior = grad_log_prior;
+    m_block_size = block_size;
+    m_pool = std::make_shared<ThreadPool>(n_threads);
+    
+    m_sum_log_lik_constructed = 1;
+    m_log_dens_constructed = 1;
+    m_grad_log_dens_constructed = (grad_log_lik != nullptr) &&
+                                  (!log_prior || grad_log_prior != nullptr);
+    
+    // The fused and batched functions would bypass the sum
+    m_log_dens_and_grad_constructed = 0;
+    m_batch_log_dens_constructed = 0;
+    m_batch_grad_log_dens_constructed = 0;
+}
+
+void LogPost::unshare_thread_pool()
+{
+    if (m_pool) m_pool = std::make_shared<ThreadPool>(m_pool->get_n_threads());
+}
+
 void LogPost::transform(const arma::vec& la_mean,
                         const arma::mat& la_cov)
 {
@@ -144,6 +325,10 @@ void LogPost::transform(const arma::vec& la_mean,
     
     m_tf_mat = eigvec * Lambda;
     
+    // Allocate the workspace
+    m_orig_state.set_size(m_dimension);
+    m_orig_grad.set_size(m_dimension);
+    
     // Indicate density is transformed
     m_transform_density = 1;
 }
@@ -166,7 +351,7 @@ int LogPost::get_dimension()
 void LogPost::print_data()
 {
     if (m_data_constructed){
-        m_data.print();
+        m_data->print();
     } else {
         std::cerr << "Data hasn't been constructed yet\n";
     }
@@ -174,7 +359,7 @@ void LogPost::print_data()
 
 void LogPost::print_data(std::ofstream &file)
 {
-    m_data.print(file);
+    m_data->print(file);
 }
 
 void LogPost::print_tf_mat()
@@ -201,19 +386,101 @@ int LogPost::is_laplacian_log_dens_constructed()
     return m_laplacian_log_dens_constructed;
 }
 
+int LogPost::is_log_dens_and_grad_constructed()
+{
+    return m_log_dens_and_grad_constructed;
+}
+
+int LogPost::is_batch_log_dens_constructed()
+{
+    return m_batch_log_dens_constructed;
+}
+
+int LogPost::is_batch_grad_log_dens_constructed()
+{
+    return m_batch_grad_log_dens_constructed;
+}
+
 double LogPost::log_dens(const arma::vec& state)
 {
+    ++m_n_log_dens_evals;
     double ld;
     if (m_transform_density){
-        arma::vec orig_state;
-        orig_state = m_la_mean + m_tf_mat * state;
-        ld = m_log_dens(orig_state, m_data);
+        m_orig_state = m_tf_mat * state;
+        m_orig_state += m_la_mean;
+        ld = eval_log_dens(m_orig_state);
     } else {
-        ld = m_log_dens(state, m_data);
+        ld = eval_log_dens(state);
+    }
+    return ld;
+}
+
+double LogPost::eval_log_dens(const arma::vec& x)
+{
+    if (!m_sum_log_lik_constructed){
+        if (m_log_dens_ptr) return m_log_dens_ptr(x, *m_data);
+        return m_log_dens(x, *m_data);
     }
+    
+    int n_blocks = get_n_blocks();
+    m_block_values.resize(n_blocks);
+    m_pool->parallel_for(n_blocks, [this, &x](int b){
+        int first_row = b * m_block_rows;
+        int last_row = std::min(first_row + m_block_rows, n_data_rows()) - 1;
+        m_block_values[b] = m_block_log_lik(x, *m_data, first_row, last_row);
+    });
+    
+    // Sum in the order of the blocks, whichever threads computed them
+    double ld = m_log_prior ? m_log_prior(x, *m_data) : 0.0;
+    for (int b = 0; b < n_blocks; ++b) ld += m_block_values[b];
     return ld;
 }
 
+void LogPost::eval_grad_log_dens(const arma::vec& x,
+                                 arma::vec& grad)
+{
+    if (!m_sum_log_lik_constructed){
+        if (m_grad_log_dens_ptr){
+            m_grad_log_dens_ptr(x, grad, *m_data);
+        } else {
+            m_grad_log_dens(x, grad, *m_data);
+        }
+        return;
+    }
+    
+    int n_blocks = get_n_blocks();
+    m_block_grads.set_size(m_dimension, n_blocks);
+    m_pool->parallel_for(n_blocks, [this, &x](int b){
+        int first_row = b * m_block_rows;
+        int last_row = std::min(first_row + m_block_rows, n_data_rows()) - 1;
+        arma::vec grad_b(m_block_grads.colptr(b), m_dimension, false, true);
+        m_block_grad_log_lik(x, grad_b, *m_data, first_row, last_row);
+    });
+    
+    if (m_log_prior){
+        m_grad_log_prior(x, grad, *m_data);
+    } else {
+        grad.zeros(m_dimension);
+    }
+    for (int b = 0; b < n_blocks; ++b) grad += m_block_grads.col(b);
+}
+
+int LogPost::n_data_rows()
+{
+    return m_data->n_rows;
+}
+
+int LogPost::get_n_blocks()
+{
+    // The blocks depend on the number of rows only (not the number of
+    // threads), so that sums are reproducible
+    int n_rows = n_data_rows();
+    m_block_rows = m_block_size;
+    if (m_block_rows < 1) m_block_rows = (n_rows + 255) / 256;
+    if (m_block_rows < 1) m_block_rows = 1;
+    return (n_rows + m_block_rows - 1) / m_block_rows;
+}
+
 double LogPost::U(const arma::vec& state)
 {
     return -log_dens(state);
@@ -222,16 +489,127 @@ double LogPost::U(const arma::vec& state)
 void LogPost::update_grad_log_dens(const arma::vec& state,
                                    arma::vec& grad)
 {
+    ++m_n_grad_log_dens_evals;
     if (m_transform_density){
-        arma::vec orig_state;
-        orig_state = m_la_mean + m_tf_mat * state;
+        m_orig_state = m_tf_mat * state;
+        m_orig_state += m_la_mean;
         
-        arma::vec aux_grad(m_dimension);
-        m_grad_log_dens(orig_state, aux_grad, m_data);
-        grad = m_tf_mat.t() * aux_grad;
+        eval_grad_log_dens(m_orig_state, m_orig_grad);
+        grad = m_tf_mat.t() * m_orig_grad;
+    } else {
+        eval_grad_log_dens(state, grad);
+    }
+}
+
+double LogPost::log_dens_and_grad(const arma::vec& state,
+                                  arma::vec& grad)
+{
+    if (!m_log_dens_and_grad_constructed){
+        update_grad_log_dens(state, grad);
+        return log_dens(state);
+    }
+    
+    ++m_n_log_dens_evals;
+    ++m_n_grad_log_dens_evals;
+    double ld;
+    if (m_transform_density){
+        m_orig_state = m_tf_mat * state;
+        m_orig_state += m_la_mean;
+        
+        ld = m_log_dens_and_grad(m_orig_state, m_orig_grad, *m_data);
+        grad = m_tf_mat.t() * m_orig_grad;
+    } else {
+        ld = m_log_dens_and_grad(state, grad, *m_data);
+    }
+    return ld;
+}
+
+void LogPost::update_minibatch_grad_log_dens(const arma::vec& state,
+                                             arma::vec& grad,
+                                             Rng& generator,
+                                             int batch_size)
+{
+    assert(m_sum_log_lik_constructed);
+    assert(m_block_grad_log_lik);
+    assert(batch_size > 0);
+    
+    // Untransformed state, and where to store the gradient with respect to it
+    const arma::vec *x = &state;
+    arma::vec *g = &grad;
+    if (m_transform_density){
+        m_orig_state = m_tf_mat * state;
+        m_orig_state += m_la_mean;
+        x = &m_orig_state;
+        g = &m_orig_grad;
+    }
+    
+    int n_rows = n_data_rows();
+    double scale = (double)n_rows / batch_size;
+    std::uniform_int_distribution<int> rrow(0, n_rows - 1);
+    
+    if (m_log_prior){
+        m_grad_log_prior(*x, *g, *m_data);
     } else {
-        m_grad_log_dens(state, grad, m_data);
+        g->zeros(m_dimension);
     }
+    if (m_control_variate) *g += m_cv_grad;
+    
+    m_row_grad.set_size(m_dimension);
+    for (int k = 0; k < batch_size; ++k)
+    {
+        int i = rrow(generator);
+        m_block_grad_log_lik(*x, m_row_grad, *m_data, i, i);
+        *g += scale * m_row_grad;
+        if (m_control_variate){
+            m_block_grad_log_lik(m_cv_anchor, m_row_grad, *m_data, i, i);
+            *g -= scale * m_row_grad;
+        }
+    }
+    
+    if (m_transform_density) grad = m_tf_mat.t() * m_orig_grad;
+}
+
+void LogPost::set_control_variate(const arma::vec& anchor)
+{
+    assert(m_sum_log_lik_constructed);
+    assert(m_block_grad_log_lik);
+    assert((int)anchor.n_elem == m_dimension);
+    
+    if (m_transform_density){
+        m_cv_anchor = m_tf_mat * anchor;
+        m_cv_anchor += m_la_mean;
+    } else {
+        m_cv_anchor = anchor;
+    }
+    
+    // Full gradient of the log likelihood (without the prior) at the anchor
+    int n_blocks = get_n_blocks();
+    m_block_grads.set_size(m_dimension, n_blocks);
+    m_pool->parallel_for(n_blocks, [this](int b){
+        int first_row = b * m_block_rows;
+        int last_row = std::min(first_row + m_block_rows, n_data_rows()) - 1;
+        arma::vec grad_b(m_block_grads.colptr(b), m_dimension, false, true);
+        m_block_grad_log_lik(m_cv_anchor, grad_b, *m_data, first_row, last_row);
+    });
+    m_cv_grad.zeros(m_dimension);
+    for (int b = 0; b < n_blocks; ++b) m_cv_grad += m_block_grads.col(b);
+    
+    m_control_variate = 1;
+}
+
+void LogPost::set_control_variate()
+{
+    if (!m_transform_density){
+        std::cerr << "Density hasn't been transformed yet\n";
+        return;
+    }
+    // The mean of the Laplace Approximation is transformed state zero
+    set_control_variate(arma::vec(m_dimension, arma::fill::zeros));
+}
+
+void LogPost::unset_control_variate()
+{
+    m_control_variate = 0;
 }
 
 void LogPost::update_grad_U(const arma::vec& state,
@@ -241,15 +619,79 @@ void LogPost::update_grad_U(const arma::vec& state,
     grad *= -1;
 }
 
+void LogPost::batch_log_dens(const arma::mat& states,
+                             arma::vec& log_dens)
+{
+    assert((int)states.n_rows == m_dimension);
+    int K = states.n_cols;
+    m_n_log_dens_evals += K;
+    
+    // Untransformed states
+    const arma::mat *x = &states;
+    if (m_transform_density){
+        m_orig_states = m_tf_mat * states;
+        m_orig_states.each_col() += m_la_mean;
+        x = &m_orig_states;
+    }
+    
+    if (m_batch_log_dens_constructed){
+        m_batch_log_dens(*x, log_dens, *m_data);
+        return;
+    }
+    
+    log_dens.set_size(K);
+    for (int k = 0; k < K; ++k)
+    {
+        // View the column without copying it
+        const arma::vec x_k(const_cast<double*>(x->colptr(k)), m_dimension,
+                            false, true);
+        log_dens[k] = eval_log_dens(x_k);
+    }
+}
+
+void LogPost::batch_grad_log_dens(const arma::mat& states,
+                                  arma::mat& grads)
+{
+    assert((int)states.n_rows == m_dimension);
+    int K = states.n_cols;
+    m_n_grad_log_dens_evals += K;
+    
+    // Untransformed states, and where to store the gradients with respect
+    // to them
+    const arma::mat *x = &states;
+    arma::mat *g = &grads;
+    if (m_transform_density){
+        m_orig_states = m_tf_mat * states;
+        m_orig_states.each_col() += m_la_mean;
+        x = &m_orig_states;
+        g = &m_orig_grads;
+    }
+    
+    if (m_batch_grad_log_dens_constructed){
+        m_batch_grad_log_dens(*x, *g, *m_data);
+    } else {
+        g->set_size(m_dimension, K);
+        for (int k = 0; k < K; ++k)
+        {
+            const arma::vec x_k(const_cast<double*>(x->colptr(k)), m_dimension,
+                                false, true);
+            arma::vec g_k(g->colptr(k), m_dimension, false, true);
+            eval_grad_log_dens(x_k, g_k);
+        }
+    }
+    
+    if (m_transform_density) grads = m_tf_mat.t() * m_orig_grads;
+}
+
 double LogPost::laplacian_log_dens(const arma::vec& state)
 {
     double lld = 0; // (Initialize for now to silence warning)
     if (m_transform_density){
         // Compute the Hessian
         arma::mat H(m_dimension, m_dimension);
-        arma::vec orig_state;
-        orig_state = m_la_mean + m_tf_mat * state;
-        m_hessian_log_dens(orig_state, H, m_data);
+        m_orig_state = m_tf_mat * state;
+        m_orig_state += m_la_mean;
+        m_hessian_log_dens(m_orig_state, H, *m_data);
         
         // Compute the Laplacian
         arma::vec col_i(m_dimension);
@@ -261,7 +703,7 @@ double LogPost::laplacian_log_dens(const arma::vec& state)
             lld += aux_mat(0,0);
         }
     } else {
-        lld = m_laplacian_log_dens(state, m_data);
+        lld = m_laplacian_log_dens(state, *m_data);
     }
     return lld;
 }
@@ -270,3 +712,19 @@ double LogPost::laplacian_U(const arma::vec& state)
 {
     return -laplacian_log_dens(state);
 }
+
+long long LogPost::get_n_log_dens_evals()
+{
+    return m_n_log_dens_evals;
+}
+
+long long LogPost::get_n_grad_log_dens_evals()
+{
+    return m_n_grad_log_dens_evals;
+}
+
+void LogPost::reset_n_evals()
+{
+    m_n_log_dens_evals = 0;
+    m_n_grad_log_dens_evals = 0;
+}
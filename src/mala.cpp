@@ -0,0 +1,155 @@
+/* Class representing a Markov chain generated using the Metropolis-adjusted
+ * Langevin Algorithm
+ */
+#include "checkpoint.h"
+#include "dual_avg.h"
+#include "log_post.h"
+#include "mala.h"
+#include "mcmc.h"
+#include "point.h"
+#include <armadillo>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <utility>
+
+MALA::MALA(const int burn,
+           const int thin,
+           const int n_samples,
+           const double epsilon)
+    : MCMC{ burn, thin, n_samples },
+    m_epsilon{ epsilon },
+    m_accept_prob{ 0.0 },
+    m_adapt_step_size{ 0 }
+{
+}
+
+MALA::MALA(LogPost log_post,
+           const arma::vec &initial_state,
+           const int burn,
+           const int thin,
+           const int n_samples,
+           const double epsilon)
+    : MCMC{ log_post, initial_state, burn, thin, n_samples },
+    m_epsilon{ epsilon },
+    m_accept_prob{ 0.0 },
+    m_adapt_step_size{ 0 }
+{
+    assert(m_posterior.is_grad_log_dens_constructed());
+    m_noise.set_size(m_dimension);
+    m_work.set_size(m_dimension);
+}
+
+void MALA::set_step_size(double epsilon)
+{
+    m_epsilon = epsilon;
+}
+
+double MALA::get_step_size()
+{
+    return m_epsilon;
+}
+
+void MALA::adapt_step_size(const double target_accept)
+{
+    m_dual_avg.set_target_accept(target_accept);
+    m_dual_avg.restart(m_epsilon);
+    m_adapt_step_size = 1;
+}
+
+void MALA::mala()
+{
+    // Check gradient information available
+    if (!m_posterior.is_grad_log_dens_constructed()){
+        std::cerr << "LogPost object doesn't contain gradient information!\n";
+    }
+    
+    run();
+}
+
+int MALA::kern()
+{
+    return mala_kern();
+}
+
+int MALA::burn_kern()
+{
+    int accept = mala_kern();
+    if (m_adapt_step_size) m_epsilon = m_dual_avg.update(m_accept_prob);
+    return accept;
+}
+
+void MALA::end_burn()
+{
+    if (m_adapt_step_size){
+        m_epsilon = m_dual_avg.get_final_step_size();
+        m_adapt_step_size = 0;
+    }
+}
+
+void MALA::save_state(std::ostream &out)
+{
+    write_value(out, m_epsilon);
+    write_value(out, m_adapt_step_size);
+    m_dual_avg.save(out);
+}
+
+void MALA::load_state(std::istream &in)
+{
+    read_value(in, m_epsilon);
+    read_value(in, m_adapt_step_size);
+    m_dual_avg.load(in);
+}
+
+double MALA::log_prop_dens(const arma::vec &to,
+                           const arma::vec &from,
+                           const arma::vec &grad_from)
+{
+    // Proposal N(from + 0.5 epsilon^2 grad_from, epsilon^2 I)
+    m_work = to - from;
+    m_work -= (0.5 * m_epsilon * m_epsilon) * grad_from;
+    return -0.5 * arma::dot(m_work, m_work) / (m_epsilon * m_epsilon);
+}
+
+int MALA::mala_kern()
+{
+    // Evaluate the log-density and gradient at the current state, unless
+    // they are still cached from a previous application of the kernel
+    if (!m_current_cached)
+    {
+        m_point_current.x = m_current;
+        m_point_current.log_dens = m_posterior.log_dens_and_grad(
+            m_current, m_point_current.grad);
+        m_current_cached = 1;
+    }
+    
+    // Propose a Langevin step
+    m_gen.fill_normal(m_noise);
+    m_point_prop.x = m_point_current.x;
+    m_point_prop.x += (0.5 * m_epsilon * m_epsilon) * m_point_current.grad;
+    m_point_prop.x += m_epsilon * m_noise;
+    m_point_prop.log_dens = m_posterior.log_dens_and_grad(m_point_prop.x,
+                                                          m_point_prop.grad);
+    
+    // Compute acceptance probability
+    double log_accept_prob = m_point_prop.log_dens - m_point_current.log_dens
+        + log_prop_dens(m_point_current.x, m_point_prop.x, m_point_prop.grad)
+        - log_prop_dens(m_point_prop.x, m_point_current.x, m_point_current.grad);
+    if (std::isnan(log_accept_prob)) log_accept_prob = -arma::datum::inf;
+    m_accept_prob = (log_accept_prob < 0) ? exp(log_accept_prob) : 1.0;
+    
+    // Accept or reject
+    double u = m_gen.uniform();
+    
+    // On rejection the cached evaluations at m_current remain valid
+    int accept = 0;
+    if (log(u) < log_accept_prob)
+    {
+        std::swap(m_point_current, m_point_prop);
+        m_current = m_point_current.x;
+        accept = 1;
+    }
+    
+    return accept;
+}
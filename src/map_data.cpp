@@ -0,0 +1,170 @@
+/* Functions to memory-map data stored in binary files
+ */
+#include "map_data.h"
+#include <armadillo>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Map the whole of file filename into memory, read-only
+ *
+ * Returns nullptr on failure, otherwise stores the length of the mapping
+ * in length.
+ */
+static void* map_file(const std::string &filename,
+                      size_t &length)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1){
+        std::cerr << "Unable to open " << filename << '\n';
+        return nullptr;
+    }
+    
+    struct stat st;
+    if ((fstat(fd, &st) == -1) || (st.st_size == 0)){
+        std::cerr << "Unable to determine the size of " << filename << '\n';
+        close(fd);
+        return nullptr;
+    }
+    length = st.st_size;
+    
+    void *addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // The mapping remains valid after the file is closed
+    if (addr == MAP_FAILED){
+        std::cerr << "Unable to map " << filename << '\n';
+        return nullptr;
+    }
+    return addr;
+}
+
+/* Wrap n_rows x n_cols doubles at mem, inside a mapping of the given
+ * length starting at addr, in a read-only arma::mat. The mapping is
+ * released when the last copy of the returned pointer is destroyed.
+ */
+static std::shared_ptr<const arma::mat> wrap_mapping(void *addr,
+                                                     size_t length,
+                                                     const double *mem,
+                                                     const arma::uword n_rows,
+                                                     const arma::uword n_cols)
+{
+    // Armadillo's auxiliary memory constructor takes a non-const pointer,
+    // but the matrix is only handed out as const (and the pages are mapped
+    // read-only)
+    arma::mat *data = new arma::mat(const_cast<double*>(mem), n_rows, n_cols,
+                                    false, true);
+    return std::shared_ptr<const arma::mat>(data,
+        [addr, length](const arma::mat *p){
+            delete p;
+            munmap(addr, length);
+        });
+}
+
+std::shared_ptr<const arma::mat> map_raw_binary(const std::string &filename,
+                                                const arma::uword n_rows,
+                                                const arma::uword n_cols)
+{
+    size_t length;
+    void *addr = map_file(filename, length);
+    if (!addr) return nullptr;
+    
+    if (length < n_rows * n_cols * sizeof(double)){
+        std::cerr << filename << " is too small for a " << n_rows << " x "
+                  << n_cols << " matrix\n";
+        munmap(addr, length);
+        return nullptr;
+    }
+    
+    return wrap_mapping(addr, length, static_cast<const double*>(addr),
+                        n_rows, n_cols);
+}
+
+std::shared_ptr<const arma::mat> map_arma_binary(const std::string &filename)
+{
+    size_t length;
+    void *addr = map_file(filename, length);
+    if (!addr) return nullptr;
+    const char *bytes = static_cast<const char*>(addr);
+    
+    // Header: "ARMA_MAT_BIN_FN008\n<n_rows> <n_cols>\n"
+    const char id[] = "ARMA_MAT_BIN_FN008\n";
+    size_t id_length = sizeof(id) - 1;
+    
+    // Find the end of the line holding the matrix size
+    size_t offset = id_length;
+    while ((offset < length) && (offset < id_length + 64) &&
+           (bytes[offset] != '\n')) ++offset;
+    
+    if ((length < id_length) || (std::memcmp(bytes, id, id_length) != 0) ||
+        (offset >= length) || (bytes[offset] != '\n')){
+        std::cerr << filename << " is not a matrix of doubles in Armadillo's"
+                  << " binary format\n";
+        munmap(addr, length);
+        return nullptr;
+    }
+    
+    std::string size_line(bytes + id_length, offset - id_length);
+    char *end;
+    arma::uword n_rows = std::strtoull(size_line.c_str(), &end, 10);
+    arma::uword n_cols = std::strtoull(end, nullptr, 10);
+    ++offset; // Data starts after the newline
+    
+    if (length - offset < n_rows * n_cols * sizeof(double)){
+        std::cerr << filename << " is too small for a " << n_rows << " x "
+                  << n_cols << " matrix\n";
+        munmap(addr, length);
+        return nullptr;
+    }
+    
+    // Copying a large dataset would defeat the purpose of mapping it, so
+    // misaligned data is an error
+    const char *mem = bytes + offset;
+    if (reinterpret_cast<std::uintptr_t>(mem) % alignof(double) != 0){
+        std::cerr << "Data in " << filename << " is misaligned for mapping;"
+                  << " save it with save_arma_binary, or in raw binary"
+                  << " format for map_raw_binary\n";
+        munmap(addr, length);
+        return nullptr;
+    }
+    
+    return wrap_mapping(addr, length, reinterpret_cast<const double*>(mem),
+                        n_rows, n_cols);
+}
+
+int save_arma_binary(const arma::mat &x,
+                     const std::string &filename)
+{
+    // Spaces between the numbers of rows and columns, which Armadillo's
+    // loader skips, pad the header to a multiple of 8 bytes
+    std::string id = "ARMA_MAT_BIN_FN008\n";
+    std::string rows = std::to_string(x.n_rows);
+    std::string cols = std::to_string(x.n_cols) + "\n";
+    size_t n_spaces = 1;
+    while ((id.size() + rows.size() + n_spaces + cols.size()) % 8 != 0)
+    {
+        ++n_spaces;
+    }
+    std::string header = id + rows + std::string(n_spaces, ' ') + cols;
+    
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()){
+        std::cerr << "Unable to open " << filename << '\n';
+        return 0;
+    }
+    file.write(header.data(), header.size());
+    file.write(reinterpret_cast<const char*>(x.memptr()),
+               x.n_elem * sizeof(double));
+    file.close();
+    if (!file){
+        std::cerr << "Unable to write " << filename << '\n';
+        return 0;
+    }
+    return 1;
+}
@@ -1,15 +1,28 @@
 /* Class representing a Markov chain generated for Monte Carlo
  */
+#include "accumulator.h"
+#include "chain_io.h"
+#include "checkpoint.h"
+#include "convergence_monitor.h"
 #include "log_post.h"
 #include "mcmc.h"
 #include "print.h"
+#include "rng.h"
+#include <algorithm>
 #include <armadillo>
 #include <cassert>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
 #include <vector>
 
+static const char checkpoint_magic[8] = { 'M', 'C', 'M', 'C', 'C', 'K', 'P', '1' };
+
 MCMC::MCMC(const int burn,
            const int thin,
            const int n_samples)
@@ -17,7 +30,21 @@ MCMC::MCMC(const int burn,
     m_thin{ thin },
     m_number_samples{ n_samples },
     m_dimension{ 1 },
-    m_samples_generated{ 0 }
+    m_samples_generated{ 0 },
+    m_current_cached{ 0 },
+    m_number_accepts{ 0 },
+    m_iteration{ 0 },
+    m_run_iteration{ 0 },
+    m_running{ 0 },
+    m_n_recorded{ 0 },
+    m_checkpoint_interval{ 0 },
+    m_store_samples{ 1 },
+    m_writer{ nullptr },
+    m_accumulator{ nullptr },
+    m_monitor{ nullptr },
+    m_monitor_chain{ 0 },
+    m_n_chunk{ 0 },
+    m_sample_memory{ nullptr }
 {
 }
 
@@ -32,13 +59,31 @@ MCMC::MCMC(LogPost posterior,
     m_number_samples{ n_samples },
     m_dimension{ 1 },
     m_samples_generated{ 0 },
+    m_current_cached{ 0 },
+    m_number_accepts{ 0 },
+    m_iteration{ 0 },
+    m_run_iteration{ 0 },
+    m_running{ 0 },
+    m_n_recorded{ 0 },
+    m_checkpoint_interval{ 0 },
+    m_store_samples{ 1 },
+    m_writer{ nullptr },
+    m_accumulator{ nullptr },
+    m_monitor{ nullptr },
+    m_monitor_chain{ 0 },
+    m_n_chunk{ 0 },
     m_initial_state{ initial_state },
-    m_current{ initial_state }
+    m_current{ initial_state },
+    m_sample_memory{ nullptr }
 {
     m_dimension = initial_state.n_elem;
     assert(m_dimension == m_posterior.get_dimension());
 }
 
+MCMC::~MCMC()
+{
+}
+
 void MCMC::set_init_state(const arma::vec &initial_state)
 {
     m_initial_state = initial_state;
@@ -46,6 +91,7 @@ void MCMC::set_init_state(const arma::vec &initial_state)
     // the dimension of m_posterior and the dimension of m_inital_state
     m_dimension = initial_state.n_elem;
     m_current = initial_state;
+    m_current_cached = 0;
 }
 
 void MCMC::set_burn(const int burn)
@@ -68,6 +114,7 @@ void MCMC::set_post(LogPost posterior)
     // Caution: changing the dimension may result in a mismatch between
     // the dimension of m_posterior and the dimension of m_inital_state
     m_posterior = posterior;
+    m_current_cached = 0;
 }
 
 void MCMC::set_seed(const unsigned int s)
@@ -75,6 +122,95 @@ void MCMC::set_seed(const unsigned int s)
     m_gen.seed(s);
 }
 
+void MCMC::set_seed(const unsigned long long s,
+                    const unsigned int stream)
+{
+    m_gen.seed(s, stream);
+}
+
+void MCMC::set_rng(const Rng::Type type)
+{
+    m_gen.set_type(type);
+}
+
+void MCMC::unshare_thread_pool()
+{
+    m_posterior.unshare_thread_pool();
+}
+
+void MCMC::set_writer(ChainWriter *writer)
+{
+    m_writer = writer;
+}
+
+void MCMC::set_accumulator(Accumulator *accumulator)
+{
+    m_accumulator = accumulator;
+}
+
+void MCMC::set_monitor(ConvergenceMonitor *monitor,
+                       const int chain)
+{
+    m_monitor = monitor;
+    m_monitor_chain = chain;
+}
+
+void MCMC::set_sink(SampleSink sink,
+                    const int chunk_size)
+{
+    assert(chunk_size > 0);
+    m_sink = sink;
+    m_chunk.set_size(m_dimension, chunk_size);
+    m_n_chunk = 0;
+}
+
+void MCMC::set_store_samples(const int store_samples)
+{
+    m_store_samples = store_samples;
+}
+
+void MCMC::set_sample_memory(double *memory)
+{
+    if (memory == m_sample_memory) return;
+    
+    // Move the samples recorded so far in a run in progress
+    if (m_running && m_store_samples){
+        long long n = (long long)m_n_recorded * m_dimension;
+        if (memory){
+            std::copy(m_samples.memptr(), m_samples.memptr() + n, memory);
+            m_samples.reset();
+        } else {
+            m_samples.set_size(m_dimension, m_n_recorded);
+            std::copy(m_sample_memory, m_sample_memory + n,
+                      m_samples.memptr());
+        }
+    }
+    m_sample_memory = memory;
+}
+
+void MCMC::set_checkpoint(const std::string &filename,
+                          const int interval)
+{
+    assert(interval >= 0);
+    m_checkpoint_file = filename;
+    m_checkpoint_interval = interval;
+}
+
+int MCMC::get_store_samples()
+{
+    return m_store_samples;
+}
+
+std::string MCMC::get_checkpoint_file()
+{
+    return m_checkpoint_file;
+}
+
+int MCMC::get_checkpoint_interval()
+{
+    return m_checkpoint_interval;
+}
+
 int MCMC::get_burn()
 {
     return m_burn;
@@ -95,31 +231,370 @@ int MCMC::get_dimension()
     return m_dimension;
 }
 
+int MCMC::get_n_accepts()
+{
+    return m_number_accepts;
+}
+
 void MCMC::get_current_state(arma::vec &state)
 {
     state = m_current;
 }
 
+unsigned long long MCMC::get_iteration()
+{
+    return m_iteration;
+}
+
+int MCMC::get_n_recorded()
+{
+    return m_n_recorded;
+}
+
+int MCMC::is_running()
+{
+    return m_running;
+}
+
+long long MCMC::get_n_log_dens_evals()
+{
+    return m_posterior.get_n_log_dens_evals();
+}
+
+long long MCMC::get_n_grad_log_dens_evals()
+{
+    return m_posterior.get_n_grad_log_dens_evals();
+}
+
 void MCMC::get_samples(std::vector<arma::vec> &samples)
 {
     assert(m_samples_generated);
-    samples = m_samples;
+    samples.resize(m_samples.n_cols);
+    for (arma::uword i = 0; i < m_samples.n_cols; ++i)
+    {
+        samples[i] = m_samples.col(i);
+    }
+}
+
+const arma::mat& MCMC::get_samples()
+{
+    assert(m_samples_generated);
+    return m_samples;
 }
 
 void MCMC::est_moments(arma::vec &mo1_est,
                        arma::vec &mo2_est)
 {
-    mo1_est.zeros(m_dimension);
-    mo2_est.zeros(m_dimension);
-    for (std::vector<arma::vec>::iterator row = m_samples.begin();
-         row != m_samples.end(); ++row)
+    mo1_est = arma::mean(m_samples, 1);
+    mo2_est = arma::mean(arma::square(m_samples), 1);
+}
+
+void MCMC::run()
+{
+    if (!m_running) start_run();
+    step(run_length() - m_run_iteration);
+}
+
+int MCMC::step(const long long n)
+{
+    assert(n >= 0);
+    int n_recorded = m_running ? m_n_recorded : 0;
+    if (!m_running) start_run();
+    
+    // Progress is tracked by m_run_iteration alone, so that a run can be
+    // continued by a later call, or from a checkpoint
+    long long n_iter = run_length();
+    long long last = std::min(m_run_iteration + n, n_iter);
+    while (m_run_iteration < last)
+    {
+        m_number_accepts += apply_kern(m_run_iteration < m_burn);
+        ++m_run_iteration;
+        complete_iteration();
+        if (m_checkpoint_interval &&
+            (m_run_iteration % m_checkpoint_interval == 0)){
+            write_checkpoint();
+        }
+    }
+    
+    if (m_run_iteration == n_iter){
+        finish();
+    } else {
+        flush_chunk();
+    }
+    return m_n_recorded - n_recorded;
+}
+
+void MCMC::finish()
+{
+    if (!m_running) return;
+    flush_chunk();
+    if (m_store_samples && !m_sample_memory){
+        m_samples.resize(m_dimension, m_n_recorded);
+    }
+    if (m_writer) m_writer->flush();
+    m_running = 0;
+    m_samples_generated = 1;
+}
+
+int MCMC::run_until_converged(const double target_ess,
+                              const double max_rhat,
+                              const int check_interval)
+{
+    assert(check_interval > 0);
+    ConvergenceMonitor monitor(m_dimension);
+    if (m_running && m_store_samples){
+        double *samples = recorded_samples();
+        for (int i = 0; i < m_n_recorded; ++i)
+        {
+            arma::vec x(samples + (long long)i * m_dimension, m_dimension,
+                        false, true);
+            monitor.add(0, x);
+        }
+    }
+    
+    ConvergenceMonitor *user_monitor = m_monitor;
+    int user_monitor_chain = m_monitor_chain;
+    set_monitor(&monitor, 0);
+    
+    // The first step also completes the burn-in period
+    int converged = 0;
+    do
     {
-        mo1_est += *row;
-        mo2_est += (*row) % (*row);
+        long long n_burn_left = m_running ?
+                                std::max(m_burn - m_run_iteration, 0LL) :
+                                m_burn;
+        step(n_burn_left + (long long)check_interval * m_thin);
+        converged = monitor.converged(target_ess, max_rhat);
+    } while (m_running && !converged);
+    finish();
+    
+    set_monitor(user_monitor, user_monitor_chain);
+    return converged;
+}
+
+int MCMC::resume(const std::string &filename)
+{
+    if (!load_checkpoint(filename)) return 0;
+    run();
+    return 1;
+}
+
+int MCMC::load_checkpoint(const std::string &filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()){
+        std::cerr << "Unable to open " << filename << '\n';
+        return 0;
+    }
+    
+    // Check the checkpoint was written by a chain set up like this one
+    // before changing anything
+    char magic[8];
+    int dimension = 0, burn = 0, thin = 0, n_samples = 0;
+    file.read(magic, sizeof(magic));
+    read_value(file, dimension);
+    read_value(file, burn);
+    read_value(file, thin);
+    read_value(file, n_samples);
+    if (!file || std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0){
+        std::cerr << filename << " is not a checkpoint\n";
+        return 0;
+    }
+    if ((dimension != m_dimension) || (burn != m_burn) || (thin != m_thin) ||
+        (n_samples != m_number_samples)){
+        std::cerr << "Checkpoint " << filename << " doesn't match the chain\n";
+        return 0;
+    }
+    
+    read_value(file, m_run_iteration);
+    read_value(file, m_iteration);
+    read_value(file, m_number_accepts);
+    read_mat(file, m_current);
+    m_current_cached = 0;
+    m_gen.load(file);
+    
+    // Samples recorded so far
+    read_value(file, m_store_samples);
+    read_value(file, m_n_recorded);
+    if (m_store_samples){
+        if (!m_sample_memory) m_samples.set_size(m_dimension, m_n_recorded);
+        file.read(reinterpret_cast<char*>(recorded_samples()),
+                  (long long)m_n_recorded * m_dimension * sizeof(double));
+    } else {
+        m_samples.reset();
+    }
+    m_n_chunk = 0;
+    
+    // Number of samples in the writer's file at the checkpoint (-1 if none)
+    long long n_written = -1;
+    read_value(file, n_written);
+    
+    // The state of the accumulator is restored if one is set
+    std::string acc_state;
+    read_string(file, acc_state);
+    if (m_accumulator && !acc_state.empty()){
+        std::istringstream acc_in(acc_state);
+        m_accumulator->load(acc_in);
+    }
+    
+    load_state(file);
+    if (!file){
+        std::cerr << "Unable to read checkpoint " << filename << '\n';
+        return 0;
+    }
+    
+    // Samples streamed after the checkpoint will be written again
+    if (m_writer && (n_written >= 0) && !m_writer->truncate(n_written)){
+        return 0;
+    }
+    
+    m_samples_generated = 0;
+    m_running = 1;
+    return 1;
+}
+
+int MCMC::apply_kern(const int burn_in)
+{
+    m_gen.set_iteration(m_iteration++);
+    return burn_in ? burn_kern() : kern();
+}
+
+int MCMC::burn_kern()
+{
+    return kern();
+}
+
+void MCMC::end_burn()
+{
+}
+
+void MCMC::save_state(std::ostream &)
+{
+}
+
+void MCMC::load_state(std::istream &)
+{
+}
+
+void MCMC::record_sample(const int i)
+{
+    m_n_recorded = i + 1;
+    if (m_store_samples && m_sample_memory){
+        std::copy(m_current.begin(), m_current.end(),
+                  m_sample_memory + (long long)i * m_dimension);
+    } else if (m_store_samples){
+        // Storage grows geometrically, so a run finished early needn't
+        // have allocated space for all n_samples samples
+        if (i >= (int)m_samples.n_cols){
+            int n_cols = std::max(2 * (int)m_samples.n_cols, 1024);
+            m_samples.resize(m_dimension, std::min(n_cols, m_number_samples));
+        }
+        m_samples.col(i) = m_current;
+    }
+    if (m_writer) m_writer->write(m_current);
+    if (m_accumulator) m_accumulator->add(m_current);
+    if (m_monitor) m_monitor->add(m_monitor_chain, m_current);
+    if (m_sink){
+        // The sink may have been set before the dimension was
+        if ((int)m_chunk.n_rows != m_dimension){
+            m_chunk.set_size(m_dimension, m_chunk.n_cols);
+        }
+        m_chunk.col(m_n_chunk++) = m_current;
+        if (m_n_chunk == (int)m_chunk.n_cols) flush_chunk();
+    }
+}
+
+void MCMC::start_run()
+{
+    m_samples.reset();
+    m_run_iteration = 0;
+    m_n_recorded = 0;
+    m_n_chunk = 0;
+    m_running = 1;
+    m_samples_generated = 0;
+    complete_iteration();
+}
+
+long long MCMC::run_length()
+{
+    return m_burn + (long long)(m_number_samples - 1) * m_thin;
+}
+
+void MCMC::complete_iteration()
+{
+    if (m_run_iteration == m_burn) end_burn();
+    if (m_run_iteration < m_burn) return;
+    
+    long long offset = m_run_iteration - m_burn;
+    if (offset % m_thin == 0) record_sample(offset / m_thin);
+}
+
+void MCMC::flush_chunk()
+{
+    if (!m_sink || (m_n_chunk == 0)) return;
+    
+    // View of the samples in the chunk, without copying them
+    arma::mat chunk(m_chunk.memptr(), m_dimension, m_n_chunk, false, true);
+    int first = m_n_recorded - m_n_chunk;
+    m_n_chunk = 0;
+    m_sink(chunk, first);
+}
+
+double* MCMC::recorded_samples()
+{
+    return m_sample_memory ? m_sample_memory : m_samples.memptr();
+}
+
+void MCMC::write_checkpoint()
+{
+    // Samples recorded so far reach the writer's file and the sink before
+    // the checkpoint is written
+    if (m_writer) m_writer->flush();
+    flush_chunk();
+    
+    std::string tmp_file = m_checkpoint_file + ".tmp";
+    std::ofstream file(tmp_file, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()){
+        std::cerr << "Unable to open " << tmp_file << '\n';
+        return;
+    }
+    
+    file.write(checkpoint_magic, sizeof(checkpoint_magic));
+    write_value(file, m_dimension);
+    write_value(file, m_burn);
+    write_value(file, m_thin);
+    write_value(file, m_number_samples);
+    
+    write_value(file, m_run_iteration);
+    write_value(file, m_iteration);
+    write_value(file, m_number_accepts);
+    write_mat(file, m_current);
+    m_gen.save(file);
+    
+    write_value(file, m_store_samples);
+    write_value(file, m_n_recorded);
+    if (m_store_samples){
+        file.write(reinterpret_cast<const char*>(recorded_samples()),
+                   (long long)m_n_recorded * m_dimension * sizeof(double));
+    }
+    
+    write_value(file, m_writer ? m_writer->get_n_samples() : -1LL);
+    
+    std::ostringstream acc_state;
+    if (m_accumulator) m_accumulator->save(acc_state);
+    write_string(file, acc_state.str());
+    
+    save_state(file);
+    file.close();
+    if (!file){
+        std::cerr << "Unable to write " << tmp_file << '\n';
+        return;
+    }
+    
+    // Renaming replaces the previous checkpoint in a single step
+    if (std::rename(tmp_file.c_str(), m_checkpoint_file.c_str()) != 0){
+        std::cerr << "Unable to replace " << m_checkpoint_file << '\n';
     }
-    int n = m_samples.size();
-    mo1_est /= n;
-    mo2_est /= n;
 }
 
 void MCMC::print_current()
@@ -129,10 +604,10 @@ void MCMC::print_current()
 
 void MCMC::print_chain()
 {
-    print_vector_vec(m_samples);
+    print_columns(m_samples);
 }
 
 void MCMC::print_chain(std::ofstream &file)
 {
-    print_vector_vec(m_samples, file);
+    print_columns(m_samples, file);
 }
@@ -0,0 +1,151 @@
+/* Class representing the metric (mass matrix) M of Hamiltonian Monte Carlo
+ */
+#include "checkpoint.h"
+#include "metric.h"
+#include "rng.h"
+#include <armadillo>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+
+Metric::Metric(const int dimension)
+    : m_type{ UNIT },
+    m_dimension{ dimension }
+{
+    assert(dimension > 0);
+    m_work.set_size(m_dimension);
+}
+
+void Metric::set_unit()
+{
+    m_type = UNIT;
+}
+
+void Metric::set_diag(const arma::vec &inv_metric)
+{
+    assert((int)inv_metric.n_elem == m_dimension);
+    m_inv_diag = inv_metric;
+    m_inv_diag_sqrt = arma::sqrt(inv_metric);
+    m_type = DIAG;
+}
+
+void Metric::set_dense(const arma::mat &inv_metric)
+{
+    assert((int)inv_metric.n_rows == m_dimension);
+    m_inv_dense = inv_metric;
+    if (!arma::chol(m_inv_chol, m_inv_dense)){
+        std::cerr << "Inverse metric is not symmetric positive definite!\n";
+        return;
+    }
+    m_type = DENSE;
+}
+
+Metric::Type Metric::get_type()
+{
+    return m_type;
+}
+
+int Metric::get_dimension()
+{
+    return m_dimension;
+}
+
+void Metric::get_inv_metric(arma::mat &inv_metric)
+{
+    if (m_type == DENSE){
+        inv_metric = m_inv_dense;
+    } else if (m_type == DIAG){
+        inv_metric = arma::diagmat(m_inv_diag);
+    } else {
+        inv_metric.eye(m_dimension, m_dimension);
+    }
+}
+
+void Metric::sample_velocity(Rng &generator,
+                             arma::vec &v)
+{
+    v.set_size(m_dimension);
+    generator.fill_normal(v);
+    
+    if (m_type == DIAG){
+        v /= m_inv_diag_sqrt;
+    } else if (m_type == DENSE){
+        // With inverse metric U^T U, the metric is U^{-1} U^{-T}, so
+        // U^{-1} z has covariance M. Back substitution in place.
+        for (int i = m_dimension - 1; i >= 0; --i)
+        {
+            double s = v[i];
+            for (int j = i + 1; j < m_dimension; ++j) s -= m_inv_chol(i,j) * v[j];
+            v[i] = s / m_inv_chol(i,i);
+        }
+    }
+}
+
+double Metric::kinetic(const arma::vec &v)
+{
+    if (m_type == DIAG){
+        double k = 0.0;
+        for (int i = 0; i < m_dimension; ++i) k += m_inv_diag[i] * v[i] * v[i];
+        return 0.5 * k;
+    } else if (m_type == DENSE){
+        m_work = m_inv_chol * v;
+        return 0.5 * arma::dot(m_work, m_work);
+    }
+    return 0.5 * arma::dot(v, v);
+}
+
+void Metric::apply_inv(const arma::vec &v,
+                       arma::vec &out)
+{
+    if (m_type == DIAG){
+        out = m_inv_diag % v;
+    } else if (m_type == DENSE){
+        out = m_inv_dense * v;
+    } else {
+        out = v;
+    }
+}
+
+void Metric::update_position(arma::vec &x,
+                             const arma::vec &v,
+                             const double epsilon)
+{
+    if (m_type == DIAG){
+        x += epsilon * (m_inv_diag % v);
+    } else if (m_type == DENSE){
+        m_work = m_inv_dense * v;
+        x += epsilon * m_work;
+    } else {
+        x += epsilon * v;
+    }
+}
+
+void Metric::save(std::ostream &out)
+{
+    write_value(out, (int)m_type);
+    write_value(out, m_dimension);
+    if (m_type == DIAG) write_mat(out, m_inv_diag);
+    if (m_type == DENSE) write_mat(out, m_inv_dense);
+}
+
+void Metric::load(std::istream &in)
+{
+    int type = 0, dimension = 0;
+    read_value(in, type);
+    read_value(in, dimension);
+    assert(dimension == m_dimension);
+    
+    // The square root and Cholesky factor are recomputed, exactly as when
+    // the metric was set
+    if (type == DIAG){
+        arma::vec inv_metric;
+        read_mat(in, inv_metric);
+        set_diag(inv_metric);
+    } else if (type == DENSE){
+        arma::mat inv_metric;
+        read_mat(in, inv_metric);
+        set_dense(inv_metric);
+    } else {
+        set_unit();
+    }
+}
@@ -2,9 +2,11 @@
  * a multivariate Gaussian distribution
  */
 #include "mvg.h"
+#include "rng.h"
 #include <armadillo>
 #include <cassert>
 #include <cmath>
+#include <iostream>
 #include <random>
 
 double mvg_ld(const arma::vec &state,
@@ -12,12 +14,11 @@ double mvg_ld(const arma::vec &state,
               const arma::mat &L)
 {
     int d = state.n_elem; // Dimension
-    arma::mat Sigma = L * L.t(); // Covariance matrix
-    // Log normalizing constant
-    double logZ = 0.5*d*log(2*M_PI) + 0.5*log(arma::det(Sigma));
+    // Log normalizing constant, using log|Sigma| = 2 sum(log(diag(L)))
+    double logZ = 0.5*d*log(2*M_PI) + arma::sum(arma::log(L.diag()));
     
     arma::vec y = state - mu;
-    arma::vec w = arma::solve(L, y);
+    arma::vec w = arma::solve(arma::trimatl(L), y);
     
     double ss = arma::sum(w % w);
     
@@ -43,10 +44,8 @@ double mvg_ld_un(const arma::vec &state,
                  const arma::vec &mu,
                  const arma::mat &L)
 {
-    arma::mat Sigma = L * L.t(); // Covariance matrix
-    
     arma::vec y = state - mu;
-    arma::vec w = arma::solve(L, y);
+    arma::vec w = arma::solve(arma::trimatl(L), y);
     
     double ss = arma::sum(w % w);
     
@@ -73,9 +72,10 @@ void mvg_grad_ld(const arma::vec &state,
                  const arma::vec &mu,
                  const arma::mat &L)
 {
+    // Sigma^{-1} y by two triangular solves
     arma::vec y = state - mu;
-    arma::mat Sigma = L * L.t();
-    grad = arma::solve(Sigma, y);
+    arma::vec w = arma::solve(arma::trimatl(L), y);
+    grad = arma::solve(arma::trimatu(L.t()), w);
     grad *= -1;
 }
 
@@ -98,8 +98,9 @@ double mvg_lap_ld(const arma::vec &state,
                   const arma::vec &mu,
                   const arma::mat &L)
 {
-    arma::mat precision = arma::inv(L.t()) * arma::inv(L);
-    return -arma::trace(precision);
+    // trace(Sigma^{-1}) is the squared Frobenius norm of L^{-1}
+    arma::mat L_inv = arma::inv(arma::trimatl(L));
+    return -arma::accu(L_inv % L_inv);
 }
 
 double mvg_lap_ld(const arma::vec &state,
@@ -117,6 +118,52 @@ double mvg_lap_ld(const arma::vec &state,
     return lld;
 }
 
+void mvg_ld_batch(const arma::mat &states,
+                  arma::vec &log_dens,
+                  const arma::mat &mu_L)
+{
+    int d = states.n_rows;
+    mvg_ld_un_batch(states, log_dens, mu_L);
+    
+    // Log normalizing constant, from the diagonal of L (offset by the
+    // column holding mu)
+    double logZ = 0.5*d*log(2*M_PI);
+    for (int i = 0; i < d; ++i) logZ += log(mu_L(i, i + 1));
+    log_dens -= logZ;
+}
+
+void mvg_ld_un_batch(const arma::mat &states,
+                     arma::vec &log_dens,
+                     const arma::mat &mu_L)
+{
+    assert(states.n_rows == mu_L.n_rows);
+    assert(mu_L.n_cols == mu_L.n_rows + 1);
+    
+    int d = states.n_rows;
+    arma::mat L = mu_L.cols(1, d);
+    
+    // One triangular solve for all of the states
+    arma::mat Y = states.each_col() - mu_L.col(0);
+    arma::mat W = arma::solve(arma::trimatl(L), Y);
+    log_dens = -0.5 * arma::sum(W % W, 0).t();
+}
+
+void mvg_grad_ld_batch(const arma::mat &states,
+                       arma::mat &grads,
+                       const arma::mat &mu_L)
+{
+    assert(states.n_rows == mu_L.n_rows);
+    assert(mu_L.n_cols == mu_L.n_rows + 1);
+    
+    int d = states.n_rows;
+    arma::mat L = mu_L.cols(1, d);
+    
+    arma::mat Y = states.each_col() - mu_L.col(0);
+    arma::mat W = arma::solve(arma::trimatl(L), Y);
+    grads = arma::solve(arma::trimatu(L.t()), W);
+    grads *= -1;
+}
+
 void rmvg(std::mt19937_64 &generator,
           arma::vec &state,
           const arma::vec &mu,
@@ -133,7 +180,7 @@ void rmvg(std::mt19937_64 &generator,
     }
     
     // Transform
-    state = (L * Z) + mu;
+    state = (arma::trimatl(L) * Z) + mu;
 }
 
 int rmvg(std::mt19937_64 &generator,
@@ -152,3 +199,127 @@ int rmvg(std::mt19937_64 &generator,
     
     return 0;
 }
+
+void rmvg(Rng &generator,
+          arma::vec &state,
+          const arma::vec &mu,
+          const arma::mat &L)
+{
+    // Generate an isotropic Gaussian, then transform
+    state.set_size(mu.n_elem);
+    generator.fill_normal(state);
+    state = arma::trimatl(L) * state;
+    state += mu;
+}
+
+MVG::MVG(const arma::vec &mu,
+         const arma::mat &Sigma)
+    : m_dimension{ (int)mu.n_elem },
+    m_mu{ mu }
+{
+    assert(Sigma.n_rows == mu.n_elem);
+    assert(Sigma.n_cols == mu.n_elem);
+    if (!arma::chol(m_L, Sigma, "lower")){
+        std::cerr << "Sigma is not symmetric positive definite!\n";
+    }
+    precompute();
+}
+
+MVG::MVG(const arma::mat &mu_L)
+    : m_dimension{ (int)mu_L.n_rows }
+{
+    assert(mu_L.n_cols == mu_L.n_rows + 1);
+    m_mu = mu_L.col(0);
+    m_L = mu_L.cols(1, m_dimension);
+    precompute();
+}
+
+void MVG::precompute()
+{
+    m_logZ = 0.5*m_dimension*log(2*M_PI) + arma::sum(arma::log(m_L.diag()));
+    arma::mat L_inv = arma::inv(arma::trimatl(m_L));
+    m_trace_precision = arma::accu(L_inv % L_inv);
+}
+
+int MVG::get_dimension() const
+{
+    return m_dimension;
+}
+
+const arma::vec& MVG::get_mean() const
+{
+    return m_mu;
+}
+
+const arma::mat& MVG::get_chol() const
+{
+    return m_L;
+}
+
+double MVG::log_dens(const arma::vec &state) const
+{
+    return log_dens_un(state) - m_logZ;
+}
+
+double MVG::log_dens_un(const arma::vec &state) const
+{
+    arma::vec w = arma::solve(arma::trimatl(m_L), state - m_mu);
+    return -0.5 * arma::dot(w, w);
+}
+
+void MVG::grad_log_dens(const arma::vec &state,
+                        arma::vec &grad) const
+{
+    log_dens_and_grad(state, grad);
+}
+
+double MVG::log_dens_and_grad(const arma::vec &state,
+                              arma::vec &grad) const
+{
+    // w = L^{-1} (state - mu) gives both the log-density and, after a
+    // second triangular solve, the gradient -Sigma^{-1} (state - mu)
+    arma::vec w = arma::solve(arma::trimatl(m_L), state - m_mu);
+    grad = arma::solve(arma::trimatu(m_L.t()), w);
+    grad *= -1;
+    return -0.5 * arma::dot(w, w) - m_logZ;
+}
+
+void MVG::batch_log_dens(const arma::mat &states,
+                         arma::vec &log_dens) const
+{
+    arma::mat W = arma::solve(arma::trimatl(m_L), states.each_col() - m_mu);
+    log_dens = -0.5 * arma::sum(W % W, 0).t();
+    log_dens -= m_logZ;
+}
+
+void MVG::batch_grad_log_dens(const arma::mat &states,
+                              arma::mat &grads) const
+{
+    arma::mat W = arma::solve(arma::trimatl(m_L), states.each_col() - m_mu);
+    grads = arma::solve(arma::trimatu(m_L.t()), W);
+    grads *= -1;
+}
+
+double MVG::laplacian_log_dens() const
+{
+    return -m_trace_precision;
+}
+
+void MVG::sample(Rng &generator,
+                 arma::vec &state) const
+{
+    state.set_size(m_dimension);
+    generator.fill_normal(state);
+    state = arma::trimatl(m_L) * state;
+    state += m_mu;
+}
+
+void MVG::sample(Rng &generator,
+                 arma::mat &states,
+                 const int n) const
+{
+    states.set_size(m_dimension, n);
+    generator.fill_normal(states);
+    states = arma::trimatl(m_L) * states;
+    states.each_col() += m_mu;
+}
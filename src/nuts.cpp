@@ -0,0 +1,377 @@
+/* Class representing a Markov chain generated using the No-U-Turn Sampler
+ */
+#include "checkpoint.h"
+#include "dual_avg.h"
+#include "leapfrog.h"
+#include "log_post.h"
+#include "mcmc.h"
+#include "metric.h"
+#include "nuts.h"
+#include "point.h"
+#include <armadillo>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+// log(exp(a) + exp(b))
+static double log_sum_exp(const double a,
+                          const double b)
+{
+    if (a > b) return a + log1p(exp(b - a));
+    return b + log1p(exp(a - b));
+}
+
+// Indicator of whether a trajectory, with M^{-1} times the velocities at
+// its ends p_sharp_begin and p_sharp_end and sum of velocities rho,
+// has not yet made a U-turn
+static int no_u_turn(const arma::vec &p_sharp_begin,
+                     const arma::vec &p_sharp_end,
+                     const arma::vec &rho)
+{
+    return (arma::dot(p_sharp_begin, rho) > 0) &&
+           (arma::dot(p_sharp_end, rho) > 0);
+}
+
+NUTS::NUTS(const int burn,
+           const int thin,
+           const int n_samples,
+           const double epsilon,
+           const int max_depth)
+    : MCMC{ burn, thin, n_samples },
+    m_epsilon{ epsilon },
+    m_accept_stat{ 0.0 },
+    m_max_delta_H{ 1000.0 },
+    m_max_depth{ max_depth },
+    m_tree_depth{ 0 },
+    m_divergent{ 0 },
+    m_adapt_step_size{ 0 },
+    m_n_iter{ 0 },
+    m_n_divergent{ 0 },
+    m_sum_tree_depth{ 0 },
+    m_n_leapfrog{ 0 },
+    m_sum_accept_stat{ 0.0 },
+    m_n_steps{ 0 }
+{
+    assert(max_depth > 0);
+}
+
+NUTS::NUTS(LogPost log_post,
+           const arma::vec &initial_state,
+           const int burn,
+           const int thin,
+           const int n_samples,
+           const double epsilon,
+           const int max_depth)
+    : MCMC{ log_post, initial_state, burn, thin, n_samples },
+    m_epsilon{ epsilon },
+    m_accept_stat{ 0.0 },
+    m_max_delta_H{ 1000.0 },
+    m_max_depth{ max_depth },
+    m_tree_depth{ 0 },
+    m_divergent{ 0 },
+    m_adapt_step_size{ 0 },
+    m_n_iter{ 0 },
+    m_n_divergent{ 0 },
+    m_sum_tree_depth{ 0 },
+    m_n_leapfrog{ 0 },
+    m_sum_accept_stat{ 0.0 },
+    m_n_steps{ 0 },
+    m_metric{ (int)initial_state.n_elem }
+{
+    assert(m_posterior.is_grad_log_dens_constructed());
+    assert(max_depth > 0);
+    allocate_trees();
+}
+
+void NUTS::set_step_size(double epsilon)
+{
+    m_epsilon = epsilon;
+}
+
+void NUTS::set_max_depth(int max_depth)
+{
+    assert(max_depth > 0);
+    m_max_depth = max_depth;
+    allocate_trees();
+}
+
+double NUTS::get_step_size()
+{
+    return m_epsilon;
+}
+
+int NUTS::get_max_depth()
+{
+    return m_max_depth;
+}
+
+void NUTS::adapt_step_size(const double target_accept)
+{
+    m_dual_avg.set_target_accept(target_accept);
+    m_dual_avg.restart(m_epsilon);
+    m_adapt_step_size = 1;
+}
+
+void NUTS::set_metric(Metric metric)
+{
+    assert(metric.get_dimension() == m_dimension);
+    m_metric = metric;
+}
+
+Metric NUTS::get_metric()
+{
+    return m_metric;
+}
+
+int NUTS::get_tree_depth()
+{
+    return m_tree_depth;
+}
+
+double NUTS::get_mean_tree_depth()
+{
+    if (m_n_iter == 0) return 0.0;
+    return (double)m_sum_tree_depth / m_n_iter;
+}
+
+int NUTS::get_n_divergent()
+{
+    return m_n_divergent;
+}
+
+long long NUTS::get_n_leapfrog()
+{
+    return m_n_leapfrog;
+}
+
+void NUTS::nuts()
+{
+    // Check gradient information available
+    if (!m_posterior.is_grad_log_dens_constructed()){
+        std::cerr << "LogPost object doesn't contain gradient information!\n";
+    }
+    
+    run();
+}
+
+void NUTS::save_state(std::ostream &out)
+{
+    write_value(out, m_epsilon);
+    write_value(out, m_adapt_step_size);
+    m_dual_avg.save(out);
+    m_metric.save(out);
+    write_value(out, m_n_iter);
+    write_value(out, m_n_divergent);
+    write_value(out, m_sum_tree_depth);
+    write_value(out, m_n_leapfrog);
+}
+
+void NUTS::load_state(std::istream &in)
+{
+    read_value(in, m_epsilon);
+    read_value(in, m_adapt_step_size);
+    m_dual_avg.load(in);
+    m_metric.load(in);
+    read_value(in, m_n_iter);
+    read_value(in, m_n_divergent);
+    read_value(in, m_sum_tree_depth);
+    read_value(in, m_n_leapfrog);
+}
+
+void NUTS::allocate_trees()
+{
+    // Sizing every buffer up front means copies between them (and the
+    // states of the trajectory) never allocate
+    Point z;
+    z.x.set_size(m_dimension);
+    z.grad.set_size(m_dimension);
+    z.log_dens = 0.0;
+    m_point_current = z;
+    m_point_sample = z;
+    m_point_fwd = z;
+    m_point_bwd = z;
+    m_current_cached = 0;
+    
+    arma::vec v(m_dimension, arma::fill::zeros);
+    m_velocity = v;
+    m_velocity_fwd = v;
+    m_velocity_bwd = v;
+    m_rho = v;
+    m_p_sharp_fwd = v;
+    m_p_sharp_bwd = v;
+    
+    m_tree_log_sum_weight.assign(m_max_depth + 1, 0.0);
+    m_tree_sample.assign(m_max_depth + 1, z);
+    m_tree_rho.assign(m_max_depth + 1, v);
+    m_tree_p_sharp_begin.assign(m_max_depth + 1, v);
+    m_tree_p_sharp_end.assign(m_max_depth + 1, v);
+}
+
+int NUTS::kern()
+{
+    int moved = nuts_kern();
+    ++m_n_iter;
+    m_sum_tree_depth += m_tree_depth;
+    m_n_divergent += m_divergent;
+    return moved;
+}
+
+int NUTS::burn_kern()
+{
+    int moved = nuts_kern();
+    if (m_adapt_step_size) m_epsilon = m_dual_avg.update(m_accept_stat);
+    return moved;
+}
+
+void NUTS::end_burn()
+{
+    if (m_adapt_step_size){
+        m_epsilon = m_dual_avg.get_final_step_size();
+        m_adapt_step_size = 0;
+    }
+}
+
+int NUTS::nuts_kern()
+{
+    // A chain constructed without a posterior, or given an initial state
+    // of another dimension since, sizes its buffers on first use
+    if ((m_velocity.n_elem != (arma::uword)m_dimension) ||
+        (m_tree_sample.size() != (size_t)m_max_depth + 1)){
+        allocate_trees();
+    }
+    if (m_metric.get_dimension() != m_dimension){
+        m_metric = Metric(m_dimension);
+    }
+    
+    // Evaluate the log-density and gradient at the current state, unless
+    // they are still cached from a previous application of the kernel
+    if (!m_current_cached)
+    {
+        m_point_current.x = m_current;
+        m_point_current.log_dens = m_posterior.log_dens_and_grad(
+            m_current, m_point_current.grad);
+        m_current_cached = 1;
+    }
+    
+    // Gibbs update of the velocity
+    m_metric.sample_velocity(m_gen, m_velocity);
+    double H0 = -m_point_current.log_dens + m_metric.kinetic(m_velocity);
+    
+    // The trajectory starts as the current state alone
+    m_point_fwd = m_point_current;
+    m_point_bwd = m_point_current;
+    m_velocity_fwd = m_velocity;
+    m_velocity_bwd = m_velocity;
+    m_metric.apply_inv(m_velocity, m_p_sharp_fwd);
+    m_p_sharp_bwd = m_p_sharp_fwd;
+    m_rho = m_velocity;
+    double log_sum_weight = 0.0;
+    int moved = 0;
+    
+    m_sum_accept_stat = 0.0;
+    m_n_steps = 0;
+    m_divergent = 0;
+    
+    int depth = 0;
+    while (depth < m_max_depth)
+    {
+        // Double the trajectory, in a random direction
+        double sign = (m_gen.uniform() < 0.5) ? -1.0 : 1.0;
+        int valid;
+        if (sign > 0){
+            valid = build_tree(depth, m_point_fwd, m_velocity_fwd, sign, H0);
+        } else {
+            valid = build_tree(depth, m_point_bwd, m_velocity_bwd, sign, H0);
+        }
+        ++depth;
+        
+        // States of an invalid subtree can't be sampled
+        if (!valid) break;
+        int j = depth - 1;
+        
+        // Sample from the new subtree with probability given by its share
+        // of the weight (biased towards the new subtree, to move further)
+        if (log(m_gen.uniform()) < m_tree_log_sum_weight[j] - log_sum_weight){
+            m_point_sample = m_tree_sample[j];
+            moved = 1;
+        }
+        log_sum_weight = log_sum_exp(log_sum_weight, m_tree_log_sum_weight[j]);
+        
+        m_rho += m_tree_rho[j];
+        if (sign > 0){
+            m_p_sharp_fwd = m_tree_p_sharp_end[j];
+        } else {
+            m_p_sharp_bwd = m_tree_p_sharp_end[j];
+        }
+        if (!no_u_turn(m_p_sharp_bwd, m_p_sharp_fwd, m_rho)) break;
+    }
+    
+    m_tree_depth = depth;
+    m_n_leapfrog += m_n_steps;
+    m_accept_stat = m_sum_accept_stat / m_n_steps;
+    
+    if (moved)
+    {
+        std::swap(m_point_current, m_point_sample);
+        m_current = m_point_current.x;
+    }
+    return moved;
+}
+
+int NUTS::build_tree(const int depth,
+                     Point &z,
+                     arma::vec &v,
+                     const double sign,
+                     const double H0)
+{
+    if (depth == 0)
+    {
+        // A single leapfrog step
+        leapfrog_step(z, v, m_posterior, sign * m_epsilon, m_metric);
+        ++m_n_steps;
+        
+        double H = -z.log_dens + m_metric.kinetic(v);
+        if (std::isnan(H)) H = arma::datum::inf;
+        double log_weight = H0 - H;
+        m_sum_accept_stat += (log_weight > 0) ? 1.0 : exp(log_weight);
+        
+        if (-log_weight > m_max_delta_H){
+            m_divergent = 1;
+            return 0;
+        }
+        
+        m_tree_log_sum_weight[0] = log_weight;
+        m_tree_sample[0] = z;
+        m_tree_rho[0] = v;
+        m_metric.apply_inv(v, m_tree_p_sharp_begin[0]);
+        m_tree_p_sharp_end[0] = m_tree_p_sharp_begin[0];
+        return 1;
+    }
+    
+    // First half, whose results are moved to entry depth before the second
+    // half overwrites entry depth-1
+    if (!build_tree(depth - 1, z, v, sign, H0)) return 0;
+    m_tree_log_sum_weight[depth] = m_tree_log_sum_weight[depth - 1];
+    m_tree_sample[depth] = m_tree_sample[depth - 1];
+    m_tree_rho[depth] = m_tree_rho[depth - 1];
+    m_tree_p_sharp_begin[depth] = m_tree_p_sharp_begin[depth - 1];
+    
+    // Second half
+    if (!build_tree(depth - 1, z, v, sign, H0)) return 0;
+    
+    // Sample from the halves in proportion to their weights
+    double log_sum_weight = log_sum_exp(m_tree_log_sum_weight[depth],
+                                        m_tree_log_sum_weight[depth - 1]);
+    if (log(m_gen.uniform()) < m_tree_log_sum_weight[depth - 1] - log_sum_weight){
+        m_tree_sample[depth] = m_tree_sample[depth - 1];
+    }
+    m_tree_log_sum_weight[depth] = log_sum_weight;
+    m_tree_rho[depth] += m_tree_rho[depth - 1];
+    m_tree_p_sharp_end[depth] = m_tree_p_sharp_end[depth - 1];
+    
+    return no_u_turn(m_tree_p_sharp_begin[depth], m_tree_p_sharp_end[depth],
+                     m_tree_rho[depth]);
+}
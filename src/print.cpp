@@ -43,3 +43,30 @@ void print_vector_vec(std::vector<arma::vec> &v, std::ofstream &file)
         file << '\n';
     }
 }
+
+void print_columns(const arma::mat &m)
+{
+    for (arma::uword j = 0; j < m.n_cols; ++j)
+    {
+        const double *col = m.colptr(j);
+        for (arma::uword i = 0; i < m.n_rows; ++i)
+        {
+            std::cout << col[i] << ' ';
+        }
+        std::cout << '\n';
+    }
+}
+
+void print_columns(const arma::mat &m, std::ofstream &file)
+{
+    assert(file.is_open());
+    for (arma::uword j = 0; j < m.n_cols; ++j)
+    {
+        const double *col = m.colptr(j);
+        for (arma::uword i = 0; i < m.n_rows; ++i)
+        {
+            file << col[i] << ' ';
+        }
+        file << '\n';
+    }
+}
@@ -0,0 +1,279 @@
+/* Class representing a source of random numbers for the samplers
+ */
+#include "checkpoint.h"
+#include "rng.h"
+#include <armadillo>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+
+// Philox4x32 multipliers and Weyl sequence increments of the key
+static const std::uint32_t PHILOX_M0 = 0xD2511F53;
+static const std::uint32_t PHILOX_M1 = 0xCD9E8D57;
+static const std::uint32_t PHILOX_W0 = 0x9E3779B9;
+static const std::uint32_t PHILOX_W1 = 0xBB67AE85;
+
+// Philox4x32-10: the 128 bits out of counter ctr and key
+static void philox4x32_10(const std::uint32_t ctr[4],
+                          const std::uint32_t key[2],
+                          std::uint32_t out[4])
+{
+    std::uint32_t c0 = ctr[0];
+    std::uint32_t c1 = ctr[1];
+    std::uint32_t c2 = ctr[2];
+    std::uint32_t c3 = ctr[3];
+    std::uint32_t k0 = key[0];
+    std::uint32_t k1 = key[1];
+    
+    for (int round = 0; round < 10; ++round)
+    {
+        std::uint64_t p0 = (std::uint64_t)PHILOX_M0 * c0;
+        std::uint64_t p1 = (std::uint64_t)PHILOX_M1 * c2;
+        std::uint32_t n0 = (std::uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        std::uint32_t n1 = (std::uint32_t)p1;
+        std::uint32_t n2 = (std::uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        std::uint32_t n3 = (std::uint32_t)p0;
+        c0 = n0; c1 = n1; c2 = n2; c3 = n3;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// Uniform in (0, 1) from the top 53 of 64 random bits
+static double to_uniform(const std::uint64_t bits)
+{
+    return ((bits >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+Rng::Rng(const Type type)
+    : m_type{ type },
+    m_seed{ std::mt19937_64::default_seed },
+    m_stream{ 0 },
+    m_seeded_with_stream{ 0 },
+    m_iteration{ 0 },
+    m_counter{ 0 },
+    m_n_buffered{ 0 }
+{
+    seed((unsigned int)m_seed);
+}
+
+void Rng::set_type(const Type type)
+{
+    m_type = type;
+    if (m_seeded_with_stream){
+        seed(m_seed, m_stream);
+    } else {
+        seed((unsigned int)m_seed);
+    }
+}
+
+Rng::Type Rng::get_type()
+{
+    return m_type;
+}
+
+void Rng::seed(const unsigned int s)
+{
+    m_seed = s;
+    m_stream = 0;
+    m_seeded_with_stream = 0;
+    m_mt.seed(s);
+    m_rnorm.reset();
+    
+    m_key[0] = s;
+    m_key[1] = 0;
+    m_iteration = 0;
+    m_counter = 0;
+    m_n_buffered = 0;
+}
+
+void Rng::seed(const unsigned long long s,
+               const unsigned int stream)
+{
+    m_seed = s;
+    m_stream = stream;
+    m_seeded_with_stream = 1;
+    std::seed_seq seq{ (unsigned int)(s & 0xffffffff),
+                       (unsigned int)(s >> 32),
+                       stream };
+    m_mt.seed(seq);
+    m_rnorm.reset();
+    
+    m_key[0] = (std::uint32_t)(s & 0xffffffff);
+    m_key[1] = (std::uint32_t)(s >> 32);
+    m_iteration = 0;
+    m_counter = 0;
+    m_n_buffered = 0;
+}
+
+void Rng::set_iteration(const unsigned long long iteration)
+{
+    m_iteration = iteration;
+    m_counter = 0;
+    m_n_buffered = 0;
+}
+
+unsigned long long Rng::get_iteration()
+{
+    return m_iteration;
+}
+
+Rng::result_type Rng::operator()()
+{
+    if (m_type == MT19937) return m_mt();
+    
+    if (m_n_buffered == 0){
+        philox(m_counter++, m_buffer);
+        m_n_buffered = 2;
+    }
+    return m_buffer[2 - m_n_buffered--];
+}
+
+double Rng::uniform()
+{
+    return to_uniform((*this)());
+}
+
+void Rng::fill_normal(double *x,
+                      const int n)
+{
+    if (m_type == MT19937){
+        for (int i = 0; i < n; ++i) x[i] = m_rnorm(m_mt);
+        return;
+    }
+    
+    // Pairs of values are generated in chunks: first the random bits, one
+    // Philox block per pair (independent, so the loop can be vectorized),
+    // then a Box-Muller transform of each pair
+    const int chunk = 64;
+    std::uint64_t bits[2 * chunk];
+    int n_pairs = n / 2;
+    for (int first = 0; first < n_pairs; first += chunk)
+    {
+        int m = (n_pairs - first < chunk) ? n_pairs - first : chunk;
+        for (int k = 0; k < m; ++k)
+        {
+            philox(m_counter + k, bits + 2*k);
+        }
+        m_counter += m;
+        
+        double *y = x + 2*first;
+        for (int k = 0; k < m; ++k)
+        {
+            double r = sqrt(-2.0 * log(to_uniform(bits[2*k])));
+            double theta = 2.0 * M_PI * to_uniform(bits[2*k + 1]);
+            y[2*k] = r * cos(theta);
+            y[2*k + 1] = r * sin(theta);
+        }
+    }
+    
+    // Odd number of values: use half of one more pair
+    if (n % 2){
+        std::uint64_t last[2];
+        philox(m_counter++, last);
+        x[n - 1] = sqrt(-2.0 * log(to_uniform(last[0]))) *
+                   cos(2.0 * M_PI * to_uniform(last[1]));
+    }
+}
+
+void Rng::fill_normal(arma::mat &x)
+{
+    fill_normal(x.memptr(), x.n_elem);
+}
+
+void Rng::save(std::ostream &out)
+{
+    write_value(out, (int)m_type);
+    write_value(out, m_seed);
+    write_value(out, m_stream);
+    write_value(out, m_seeded_with_stream);
+    
+    // The standard library only provides text serialization of the
+    // Mersenne Twister and Gaussian distribution
+    std::ostringstream mt_state;
+    mt_state << m_mt << ' ' << m_rnorm;
+    write_string(out, mt_state.str());
+    
+    write_value(out, m_key[0]);
+    write_value(out, m_key[1]);
+    write_value(out, m_iteration);
+    write_value(out, m_counter);
+    write_value(out, m_buffer[0]);
+    write_value(out, m_buffer[1]);
+    write_value(out, m_n_buffered);
+}
+
+void Rng::load(std::istream &in)
+{
+    int type = 0;
+    read_value(in, type);
+    m_type = (Type)type;
+    read_value(in, m_seed);
+    read_value(in, m_stream);
+    read_value(in, m_seeded_with_stream);
+    
+    std::string mt_string;
+    read_string(in, mt_string);
+    std::istringstream mt_state(mt_string);
+    mt_state >> m_mt >> m_rnorm;
+    
+    read_value(in, m_key[0]);
+    read_value(in, m_key[1]);
+    read_value(in, m_iteration);
+    read_value(in, m_counter);
+    read_value(in, m_buffer[0]);
+    read_value(in, m_buffer[1]);
+    read_value(in, m_n_buffered);
+}
+
+int Rng::check_philox()
+{
+    // Known-answer vectors of the Random123 library: counter, key, output
+    static const std::uint32_t kat[3][10] = {
+        { 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+          0x00000000, 0x00000000,
+          0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 },
+        { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+          0xffffffff, 0xffffffff,
+          0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd },
+        { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344,
+          0xa4093822, 0x299f31d0,
+          0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } };
+    
+    for (int i = 0; i < 3; ++i)
+    {
+        std::uint32_t out[4];
+        philox4x32_10(kat[i], kat[i] + 4, out);
+        for (int j = 0; j < 4; ++j)
+        {
+            if (out[j] != kat[i][6 + j]) return 0;
+        }
+    }
+    return 1;
+}
+
+void Rng::philox(const std::uint64_t counter,
+                 std::uint64_t out[2])
+{
+    // Counter: position within the iteration, iteration (high and low
+    // words), stream. Every iteration up to 2^64 gets its own counters.
+    assert(counter <= 0xffffffff);
+    std::uint32_t ctr[4] = { (std::uint32_t)counter,
+                             (std::uint32_t)(m_iteration >> 32),
+                             m_stream,
+                             (std::uint32_t)m_iteration };
+    std::uint32_t bits[4];
+    philox4x32_10(ctr, m_key, bits);
+    
+    out[0] = ((std::uint64_t)bits[1] << 32) | bits[0];
+    out[1] = ((std::uint64_t)bits[3] << 32) | bits[2];
+}
@@ -1,6 +1,8 @@
 /* Class representing a Markov chain generated using
  * the Random Walk Metropolis algorithm
  */
+#include "accumulator.h"
+#include "checkpoint.h"
 #include "log_post.h"
 #include "mcmc.h"
 #include "rwm.h"
@@ -37,23 +39,7 @@ double RWM::get_prop_sd(){
 
 void RWM::rwm()
 {
-    // Burn-in period
-    for (int i = 0; i < m_burn; i++)
-    {
-        rwm_sym_kern();
-    }
-    // Post-burn-in
-    m_samples.push_back(m_current);
-    for (int i = 0; i < (m_number_samples-1); i++)
-    {
-        // Multiple applications of the Markov kernel
-        for (int j = 0; j < m_thin; j++)
-        {
-            rwm_sym_kern();
-        }
-        m_samples.push_back(m_current);
-    }
-    m_samples_generated = 1;
+    run();
 }
 
 void RWM::adapt_prop_sd()
@@ -63,7 +49,7 @@ void RWM::adapt_prop_sd()
         int accepts = 0;
         for (int j = 0; j < 100; j++)
         {
-            accepts += rwm_sym_kern();
+            accepts += apply_kern(0);
         }
         m_prop_sd = exp(log(m_prop_sd) + accepts/100.0 - 0.234);
     }
@@ -71,40 +57,38 @@ void RWM::adapt_prop_sd()
 
 void RWM::gen_mo_est(arma::vec &mo1_est, arma::vec &mo2_est)
 {
-    mo1_est.set_size(m_dimension);
-    mo2_est.set_size(m_dimension);
+    Accumulator acc(m_dimension);
     
     // Burn-in period
     for (int i = 0; i < m_burn; i++)
     {
-        rwm_sym_kern();
+        apply_kern(0);
     }
     
     // Post burn-in
-    mo1_est = m_current;
-    mo2_est = (m_current % m_current);
+    acc.add(m_current);
     for (int i = 0; i < (m_number_samples-1); ++i)
     {
         // Multiple applications of the Markov kernel
         for (int j = 0; j < m_thin; j++)
         {
-            rwm_sym_kern();
+            apply_kern(0);
         }
-        mo1_est += m_current;
-        mo2_est += (m_current % m_current);
+        acc.add(m_current);
     }
     
-    mo1_est /= m_number_samples;
-    mo2_est /= m_number_samples;
+    acc.get_moments(mo1_est, mo2_est);
 }
 
 double RWM::est_expec_fcn(double (*fcn)(const arma::vec &state))
 {
-    double estimate = 0;
+    Accumulator acc(m_dimension);
+    int k = acc.add_fcn(fcn);
+    
     // Burn-in period
     for (int i = 0; i < m_burn; ++i)
     {
-        rwm_sym_kern();
+        apply_kern(0);
     }
     // Post-burn-in
     for (int i = 0; i < m_number_samples; ++i)
@@ -112,32 +96,50 @@ double RWM::est_expec_fcn(double (*fcn)(const arma::vec &state))
         // Thinning
         for (int j = 0; j < m_thin; ++j)
         {
-            rwm_sym_kern();
+            apply_kern(0);
         }
-        estimate += fcn(m_current);
+        acc.add(m_current);
     }
-    return estimate/m_number_samples;
+    return acc.get_fcn_mean(k);
+}
+
+int RWM::kern()
+{
+    return rwm_sym_kern();
+}
+
+void RWM::save_state(std::ostream &out)
+{
+    write_value(out, m_prop_sd);
+}
+
+void RWM::load_state(std::istream &in)
+{
+    read_value(in, m_prop_sd);
 }
 
 int RWM::rwm_sym_kern()
 {
-    std::normal_distribution<double> rnorm(0.0, 1.0);
-    for (arma::vec::iterator it = m_prop.begin(); it != m_prop.end(); ++it)
-    {
-        *it = rnorm(m_gen);
-    }
+    m_gen.fill_normal(m_prop);
     m_prop *= m_prop_sd;
     m_prop += m_current;
     
+    // The log density at the current state only changes on acceptance
+    if (!m_current_cached)
+    {
+        m_current_log_dens = m_posterior.log_dens(m_current);
+        m_current_cached = 1;
+    }
+    
     int accept = 0;
-    double log_accept_prob = m_posterior.log_dens(m_prop) -
-                                m_posterior.log_dens(m_current);
-    std::uniform_real_distribution<double> runif(0.0, 1.0);
-    double u = runif(m_gen);
+    double prop_log_dens = m_posterior.log_dens(m_prop);
+    double log_accept_prob = prop_log_dens - m_current_log_dens;
+    double u = m_gen.uniform();
     
     if (log(u) < log_accept_prob)
     {
         m_current = m_prop;
+        m_current_log_dens = prop_log_dens;
         accept = 1;
     }
     return accept;
@@ -0,0 +1,115 @@
+/* Class representing a Markov chain generated using Stochastic Gradient
+ * Hamiltonian Monte Carlo
+ */
+#include "checkpoint.h"
+#include "log_post.h"
+#include "mcmc.h"
+#include "sghmc.h"
+#include <armadillo>
+#include <cassert>
+#include <cmath>
+#include <random>
+
+SGHMC::SGHMC(const int burn,
+             const int thin,
+             const int n_samples,
+             const double epsilon,
+             const double friction,
+             const int batch_size)
+    : MCMC{ burn, thin, n_samples },
+    m_epsilon{ epsilon },
+    m_friction{ friction },
+    m_batch_size{ batch_size }
+{
+}
+
+SGHMC::SGHMC(LogPost log_post,
+             const arma::vec &initial_state,
+             const int burn,
+             const int thin,
+             const int n_samples,
+             const double epsilon,
+             const double friction,
+             const int batch_size)
+    : MCMC{ log_post, initial_state, burn, thin, n_samples },
+    m_epsilon{ epsilon },
+    m_friction{ friction },
+    m_batch_size{ batch_size }
+{
+    assert(batch_size > 0);
+    assert(friction > 0);
+    m_velocity.zeros(m_dimension);
+    m_grad.set_size(m_dimension);
+    m_noise.set_size(m_dimension);
+}
+
+void SGHMC::set_step_size(double epsilon)
+{
+    m_epsilon = epsilon;
+}
+
+void SGHMC::set_friction(double friction)
+{
+    assert(friction > 0);
+    m_friction = friction;
+}
+
+void SGHMC::set_batch_size(int batch_size)
+{
+    assert(batch_size > 0);
+    m_batch_size = batch_size;
+}
+
+double SGHMC::get_step_size()
+{
+    return m_epsilon;
+}
+
+double SGHMC::get_friction()
+{
+    return m_friction;
+}
+
+int SGHMC::get_batch_size()
+{
+    return m_batch_size;
+}
+
+void SGHMC::sghmc()
+{
+    run();
+}
+
+int SGHMC::kern()
+{
+    return sghmc_kern();
+}
+
+void SGHMC::save_state(std::ostream &out)
+{
+    write_mat(out, m_velocity);
+}
+
+void SGHMC::load_state(std::istream &in)
+{
+    read_mat(in, m_velocity);
+}
+
+int SGHMC::sghmc_kern()
+{
+    m_posterior.update_minibatch_grad_log_dens(m_current, m_grad, m_gen,
+                                               m_batch_size);
+    
+    m_gen.fill_normal(m_noise);
+    
+    // Velocity: gradient step, friction, and noise balancing the friction
+    // (taking the noise of the gradient estimate to be negligible)
+    m_velocity += m_epsilon * m_grad;
+    m_velocity -= m_epsilon * m_friction * m_velocity;
+    m_velocity += sqrt(2.0 * m_friction * m_epsilon) * m_noise;
+    
+    // Position
+    m_current += m_epsilon * m_velocity;
+    
+    return 1;
+}
@@ -0,0 +1,82 @@
+/* Class representing a Markov chain generated using Stochastic Gradient
+ * Langevin Dynamics
+ */
+#include "log_post.h"
+#include "mcmc.h"
+#include "sgld.h"
+#include <armadillo>
+#include <cassert>
+#include <cmath>
+#include <random>
+
+SGLD::SGLD(const int burn,
+           const int thin,
+           const int n_samples,
+           const double epsilon,
+           const int batch_size)
+    : MCMC{ burn, thin, n_samples },
+    m_epsilon{ epsilon },
+    m_batch_size{ batch_size }
+{
+}
+
+SGLD::SGLD(LogPost log_post,
+           const arma::vec &initial_state,
+           const int burn,
+           const int thin,
+           const int n_samples,
+           const double epsilon,
+           const int batch_size)
+    : MCMC{ log_post, initial_state, burn, thin, n_samples },
+    m_epsilon{ epsilon },
+    m_batch_size{ batch_size }
+{
+    assert(batch_size > 0);
+    m_grad.set_size(m_dimension);
+    m_noise.set_size(m_dimension);
+}
+
+void SGLD::set_step_size(double epsilon)
+{
+    m_epsilon = epsilon;
+}
+
+void SGLD::set_batch_size(int batch_size)
+{
+    assert(batch_size > 0);
+    m_batch_size = batch_size;
+}
+
+double SGLD::get_step_size()
+{
+    return m_epsilon;
+}
+
+int SGLD::get_batch_size()
+{
+    return m_batch_size;
+}
+
+void SGLD::sgld()
+{
+    run();
+}
+
+int SGLD::kern()
+{
+    return sgld_kern();
+}
+
+int SGLD::sgld_kern()
+{
+    m_posterior.update_minibatch_grad_log_dens(m_current, m_grad, m_gen,
+                                               m_batch_size);
+    
+    m_gen.fill_normal(m_noise);
+    
+    // Euler-Maruyama step of the Langevin diffusion
+    m_current += 0.5 * m_epsilon * m_grad;
+    m_current += sqrt(m_epsilon) * m_noise;
+    
+    return 1;
+}
@@ -0,0 +1,105 @@
+/* A persistent pool of worker threads
+ */
+#include "thread_pool.h"
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+ThreadPool::ThreadPool(int n_threads)
+    : m_task{ nullptr },
+    m_n_tasks{ 0 },
+    m_next_task{ 0 },
+    m_n_unfinished{ 0 },
+    m_stop{ 0 },
+    m_generation{ 0 }
+{
+    if (n_threads < 1) n_threads = std::thread::hardware_concurrency();
+    if (n_threads < 1) n_threads = 1;
+    
+    // The calling thread also runs tasks, so needs no worker of its own
+    for (int i = 1; i < n_threads; ++i)
+    {
+        m_workers.emplace_back(&ThreadPool::worker, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = 1;
+    }
+    m_work_cv.notify_all();
+    for (std::vector<std::thread>::iterator it = m_workers.begin();
+         it != m_workers.end(); ++it)
+    {
+        it->join();
+    }
+}
+
+int ThreadPool::get_n_threads()
+{
+    return m_workers.size() + 1;
+}
+
+void ThreadPool::parallel_for(int n_tasks,
+                              const std::function<void(int)> &task)
+{
+    if (n_tasks < 1) return;
+    
+    std::lock_guard<std::mutex> call_lock(m_call_mutex);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_task = &task;
+    m_n_tasks = n_tasks;
+    m_next_task = 0;
+    m_n_unfinished = n_tasks;
+    ++m_generation;
+    m_work_cv.notify_all();
+    
+    run_tasks(lock);
+    m_done_cv.wait(lock, [this]{ return m_n_unfinished == 0; });
+    m_task = nullptr;
+    
+    std::exception_ptr exception = m_exception;
+    m_exception = nullptr;
+    if (exception) std::rethrow_exception(exception);
+}
+
+void ThreadPool::run_tasks(std::unique_lock<std::mutex> &lock)
+{
+    while (m_next_task < m_n_tasks)
+    {
+        int i = m_next_task++;
+        const std::function<void(int)> &task = *m_task;
+        lock.unlock();
+        std::exception_ptr exception;
+        try
+        {
+            task(i);
+        }
+        catch (...)
+        {
+            exception = std::current_exception();
+        }
+        lock.lock();
+        if (exception && !m_exception) m_exception = exception;
+        if (--m_n_unfinished == 0) m_done_cv.notify_all();
+    }
+}
+
+void ThreadPool::worker()
+{
+    unsigned long generation = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (1)
+    {
+        m_work_cv.wait(lock, [this, generation]{
+            return m_stop || m_generation != generation; });
+        if (m_stop) return;
+        generation = m_generation;
+        run_tasks(lock);
+    }
+}